@@ -39,6 +39,7 @@ struct llco_symbol {
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef LLCO_VALGRIND
 #include <valgrind/valgrind.h>
@@ -84,6 +85,12 @@ static void llco_exit(void) {
 #define LLCO_NOASM
 #endif
 
+// Defining LLCO_NOFPREGS makes the asm switch skip the callee-saved floating
+// point registers (d8-d15 on arm and aarch64, fs0-fs11 on riscv). Only safe
+// when no floating point values are kept in those registers across a switch.
+// The x64 and i386 switches never save them, and the Windows x64 switch
+// always does.
+
 // Passing the entry function into assembly requires casting the function 
 // pointer to an object pointer, which is forbidden in the ISO C spec but
 // allowed in posix. Ignore the warning attributed to this  requirement when
@@ -131,7 +138,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define LLCO_METHOD "asm,arm_eabi"
 
 struct llco_asmctx {
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     void* f[16];
 #endif
     void *d[4]; /* d8-d15 */
@@ -154,12 +161,12 @@ __asm__(
     ".hidden _llco_asm_switch\n"
     "_llco_asm_switch:\n"
 #endif
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     "  vstmia r0!, {d8-d15}\n"
 #endif
     "  stmia r0, {r4-r11, lr}\n"
     "  str sp, [r0, #9*4]\n"
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     "  vldmia r1!, {d8-d15}\n"
 #endif
     "  ldr sp, [r1, #9*4]\n"
@@ -235,24 +242,40 @@ __asm__(
     "  mov x11, x30\n"
     "  stp x19, x20, [x0, #(0*16)]\n"
     "  stp x21, x22, [x0, #(1*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d8, d9, [x0, #(7*16)]\n"
+#endif
     "  stp x23, x24, [x0, #(2*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d10, d11, [x0, #(8*16)]\n"
+#endif
     "  stp x25, x26, [x0, #(3*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d12, d13, [x0, #(9*16)]\n"
+#endif
     "  stp x27, x28, [x0, #(4*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d14, d15, [x0, #(10*16)]\n"
+#endif
     "  stp x29, x30, [x0, #(5*16)]\n"
     "  stp x10, x11, [x0, #(6*16)]\n"
     "  ldp x19, x20, [x1, #(0*16)]\n"
     "  ldp x21, x22, [x1, #(1*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d8, d9, [x1, #(7*16)]\n"
+#endif
     "  ldp x23, x24, [x1, #(2*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d10, d11, [x1, #(8*16)]\n"
+#endif
     "  ldp x25, x26, [x1, #(3*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d12, d13, [x1, #(9*16)]\n"
+#endif
     "  ldp x27, x28, [x1, #(4*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d14, d15, [x1, #(10*16)]\n"
+#endif
     "  ldp x29, x30, [x1, #(5*16)]\n"
     "  ldp x10, x11, [x1, #(6*16)]\n"
     "  mov sp, x10\n"
@@ -305,7 +328,7 @@ struct llco_asmctx {
     void* ra;
     void* pc;
     void* sp;
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     double fs[12]; /* fs0-fs11 */
 #elif __riscv_flen == 32
@@ -350,7 +373,7 @@ __asm__(
     "  sd ra, 0x60(a0)\n"
     "  sd ra, 0x68(a0)\n" /* pc */
     "  sd sp, 0x70(a0)\n"
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     "  fsd fs0, 0x78(a0)\n"
     "  fsd fs1, 0x80(a0)\n"
@@ -412,7 +435,7 @@ __asm__(
     "  sw ra, 0x30(a0)\n"
     "  sw ra, 0x34(a0)\n" /* pc */
     "  sw sp, 0x38(a0)\n"
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     "  fsd fs0, 0x3c(a0)\n"
     "  fsd fs1, 0x44(a0)\n"
@@ -1113,10 +1136,128 @@ const char *llco_method(void *caps) {
     return LLCO_METHOD
 #ifdef LLCO_STACKJMP
         ",stackjmp"
+#endif
+#if defined(LLCO_ASM) && defined(LLCO_NOFPREGS) && !defined(_WIN32) && \
+    ((defined(__ARM_EABI__) && !defined(__SOFTFP__)) || \
+    defined(__aarch64__) || defined(__riscv_flen))
+        // Only these switches save floating point registers.
+        ",nofp"
 #endif
     ;
 }
 
+#if defined(LLCO_ASM) && !defined(_WIN32) && (defined(__x86_64__) || \
+    defined(__i386) || defined(__i386__) || defined(__aarch64__) || \
+    defined(__riscv))
+#define LLCO_BACKTRACE
+#endif
+
+#ifdef LLCO_BACKTRACE
+
+#ifdef __riscv
+// The return address and the caller's frame pointer are stored just below
+// the frame pointer.
+#define LLCO_FRAME_LOW(fp) ((char*)(fp)-2*sizeof(void*))
+#define LLCO_FRAME_NEXT(fp) (((void**)(fp))[-2])
+#define LLCO_FRAME_RA(fp) (((void**)(fp))[-1])
+#else
+#define LLCO_FRAME_LOW(fp) ((char*)(fp))
+#define LLCO_FRAME_NEXT(fp) (((void**)(fp))[0])
+#define LLCO_FRAME_RA(fp) (((void**)(fp))[1])
+#endif
+
+// Follow the chain of frame pointers, starting at the frame of the function
+// that ip returns into, without leaving the stack memory between lo and hi.
+static int llco_walk(char *lo, char *hi, void *fp, void *ip, void *start_ip,
+    void **ips, int max)
+{
+    int n = 0;
+    bool started = !start_ip;
+    while (n < max && ip) {
+        if (!started && ip == start_ip) {
+            started = true;
+        }
+        if (started) {
+            ips[n++] = ip;
+        }
+        if ((uintptr_t)fp % sizeof(void*) || LLCO_FRAME_LOW(fp) < lo ||
+            (char*)fp+2*sizeof(void*) > hi)
+        {
+            break;
+        }
+        void *next = LLCO_FRAME_NEXT(fp);
+        ip = LLCO_FRAME_RA(fp);
+        if ((char*)next <= (char*)fp) {
+            // Frames only move toward the top of the stack.
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
+#endif
+
+// Store up to max return addresses of a coroutine into ips, by following its
+// frame pointers. Use NULL for the current coroutine, in which case nothing
+// is stored until start_ip is found, or any other coroutine that has switched
+// out, which is walked from where it switched. Only the coroutine's own
+// stack memory is read and no locks are taken, so this is safe to call from
+// a signal handler. Frames of code built without frame pointers are skipped.
+// Returns the number of addresses stored, which is zero when the switch
+// method has no frame pointers to follow.
+LLCO_EXTERN
+int llco_backtrace(struct llco *co, void *start_ip, void **ips, int max) {
+#ifdef LLCO_BACKTRACE
+    char *lo, *hi, *fp, *ip;
+    if (!co) {
+        co = llco_cur;
+        if (!co || co == &llco_thread) {
+            return 0;
+        }
+        fp = __builtin_frame_address(0);
+        lo = fp;
+        hi = (char*)co->desc.stack+co->desc.stack_size;
+        if (fp < (char*)co->desc.stack || fp >= hi) {
+            // Still on the stack of the previous coroutine.
+            return 0;
+        }
+        ip = LLCO_FRAME_RA(fp);
+        fp = LLCO_FRAME_NEXT(fp);
+    } else {
+        if (co == llco_cur || co == &llco_thread) {
+            return 0;
+        }
+#if defined(__x86_64__)
+        lo = co->ctx.rsp;
+        fp = co->ctx.rbp;
+        ip = *(void**)co->ctx.rsp;
+#elif defined(__i386) || defined(__i386__)
+        lo = co->ctx.esp;
+        fp = co->ctx.ebp;
+        ip = *(void**)co->ctx.esp;
+#elif defined(__aarch64__)
+        lo = co->ctx.sp;
+        fp = co->ctx.x[10];
+        ip = co->ctx.x[11];
+#else
+        lo = co->ctx.sp;
+        fp = co->ctx.s[0];
+        ip = co->ctx.ra;
+#endif
+        hi = (char*)co->desc.stack+co->desc.stack_size;
+        if (lo < (char*)co->desc.stack || lo >= hi) {
+            return 0;
+        }
+        start_ip = 0;
+    }
+    return llco_walk(lo, hi, fp, ip, start_ip, ips, max);
+#else
+    (void)co, (void)start_ip, (void)ips, (void)max;
+    return 0;
+#endif
+}
+
 #if defined(__GNUC__) && !defined(__EMSCRIPTEN__) && !defined(_WIN32) && \
     !defined(LLCO_NOUNWIND) && !defined(__COSMOCC__)
 
@@ -1135,6 +1276,46 @@ struct llco_dlinfo {
 int dladdr(const void *, void *);
 #endif
 
+#ifndef LLCO_SYMCACHE
+#define LLCO_SYMCACHE 256 // number of cached dladdr results, per thread
+#endif
+
+struct llco_symcache_entry {
+    void *ip;
+    bool found;
+    struct llco_dlinfo dlinfo;
+};
+
+static __thread struct llco_symcache_entry llco_symcache[LLCO_SYMCACHE];
+
+// Same as dladdr(), but remembers the result for each instruction pointer.
+// Unloading a shared object with dlclose() is not noticed, which is fine for
+// the code that stays loaded in programs that are being profiled.
+static bool llco_dladdr(void *ip, struct llco_dlinfo *dlinfo) {
+    uintptr_t h = (uintptr_t)ip;
+    h ^= h >> 17;
+    h *= 0x9e3779b1;
+    h ^= h >> 11;
+    struct llco_symcache_entry *entry = &llco_symcache[h % LLCO_SYMCACHE];
+    if (entry->ip != ip) {
+        memset(&entry->dlinfo, 0, sizeof(struct llco_dlinfo));
+        entry->found = dladdr(ip, (void*)&entry->dlinfo) != 0;
+        entry->ip = ip;
+    }
+    *dlinfo = entry->dlinfo;
+    return entry->found;
+}
+
+static void llco_fillsymbol(void *ip, struct llco_symbol *sym) {
+    struct llco_dlinfo dlinfo;
+    if (ip && llco_dladdr(ip, &dlinfo)) {
+        sym->fname = dlinfo.dli_fname;
+        sym->fbase = dlinfo.dli_fbase;
+        sym->sname = dlinfo.dli_sname;
+        sym->saddr = dlinfo.dli_saddr;
+    }
+}
+
 static void llco_getsymbol(struct _Unwind_Context *uwc, 
     struct llco_symbol *sym)
 {
@@ -1142,13 +1323,17 @@ static void llco_getsymbol(struct _Unwind_Context *uwc,
     sym->cfa = (void*)_Unwind_GetCFA(uwc);
     int ip_before; /* unused */
     sym->ip = (void*)_Unwind_GetIPInfo(uwc, &ip_before);
-    struct llco_dlinfo dlinfo = { 0 };
-    if (sym->ip && dladdr(sym->ip, (void*)&dlinfo)) {
-        sym->fname = dlinfo.dli_fname;
-        sym->fbase = dlinfo.dli_fbase;
-        sym->sname = dlinfo.dli_sname;
-        sym->saddr = dlinfo.dli_saddr;
-    }
+    llco_fillsymbol(sym->ip, sym);
+}
+
+// Look up the symbol of an instruction pointer, such as one that was returned
+// by llco_backtrace(). The cfa field is not set.
+LLCO_EXTERN
+bool llco_symbolize(void *ip, struct llco_symbol *sym) {
+    memset(sym, 0, sizeof(struct llco_symbol));
+    sym->ip = ip;
+    llco_fillsymbol(ip, sym);
+    return sym->sname || sym->fname;
 }
 
 struct llco_unwind_context {
@@ -1218,4 +1403,11 @@ int llco_unwind(bool(*func)(struct llco_symbol *sym, void *udata), void *udata){
     return 0;
 }
 
+LLCO_EXTERN
+bool llco_symbolize(void *ip, struct llco_symbol *sym) {
+    (void)ip; (void)sym;
+    /* Unsupported */
+    return false;
+}
+
 #endif
@@ -32,5 +32,7 @@ struct llco_symbol {
 };
 
 int llco_unwind(bool(*func)(struct llco_symbol *sym, void *udata), void *udata);
+int llco_backtrace(struct llco *co, void *start_ip, void **ips, int max);
+bool llco_symbolize(void *ip, struct llco_symbol *sym);
 
 #endif // LLCO_H
@@ -6,6 +6,12 @@
 
 // Coroutine scheduler
 
+// A strict -std=c11 hides nanosleep(), syscall() and MAP_ANONYMOUS on Linux,
+// unless they are asked for before the first system header.
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdatomic.h>
 #include <stdbool.h>
 
@@ -21,6 +27,8 @@ struct sco_desc {
     void (*entry)(void *udata);
     void (*cleanup)(void *stack, size_t stack_size, void *udata);
     void *udata;
+    int priority;
+    struct sco_group *group;
 };
 struct sco_symbol {
     void *cfa;            // Canonical Frame Address
@@ -30,7 +38,106 @@ struct sco_symbol {
     const char *sname;    // Name of nearest symbol
     void *saddr;          // Address of nearest symbol
 };
+struct sco_handle {
+    void *co;
+    uint64_t gen;
+};
+struct sco_stack_info {
+    void *stack;
+    size_t stack_size;
+    size_t resident;
+    size_t highwater;
+};
+struct sco_batch {
+    void *head;
+    size_t count;
+};
 #define SCO_MINSTACKSIZE 131072
+#define SCO_READ  1
+#define SCO_WRITE 2
+#define SCO_PRIO_LOW    -1
+#define SCO_PRIO_NORMAL  0
+#define SCO_PRIO_HIGH    1
+struct sco_waitq {
+    void *head;
+    void *tail;
+    size_t count;
+};
+struct sco_mutex {
+    bool locked;
+    struct sco_waitq waiters;
+};
+struct sco_sem {
+    size_t count;
+    struct sco_waitq waiters;
+};
+struct sco_group {
+    size_t count;
+    struct sco_waitq waiters;
+};
+struct sco_chan {
+    void *buf;
+    size_t elsize;
+    size_t cap;
+    size_t head;
+    size_t len;
+    bool closed;
+    struct sco_waitq senders;
+    struct sco_waitq receivers;
+};
+#define SCO_STATS_NBUCKETS 32
+struct sco_stats {
+    uint64_t starts;
+    uint64_t exits;
+    uint64_t switches;
+    uint64_t yields;
+    uint64_t pauses;
+    uint64_t resumes;
+    uint64_t waits;
+    uint64_t wait_ns;
+    uint64_t wait_hist[SCO_STATS_NBUCKETS];
+    uint64_t lock_waits;
+    uint64_t lock_wait_ns;
+};
+#define SCO_EVENT_START  1
+#define SCO_EVENT_SWITCH 2
+#define SCO_EVENT_PAUSE  3
+#define SCO_EVENT_RESUME 4
+#define SCO_EVENT_DETACH 5
+#define SCO_EVENT_ATTACH 6
+#define SCO_EVENT_EXIT   7
+#define SCO_EVENT_WAKE   8
+#define SCO_EVENT_POST   9
+#define SCO_EVENT_IDMASK UINT64_C(0x00ffffffffffffff)
+#define SCO_EVENT_TYPE(ev) ((int)((ev)>>56))
+#define SCO_EVENT_ID(ev) ((int64_t)((ev)&SCO_EVENT_IDMASK))
+#define SCO_STATE_RUNNING   1
+#define SCO_STATE_SCHEDULED 2
+#define SCO_STATE_PAUSED    3
+#define SCO_STATE_SLEEPING  4
+#define SCO_STATE_WAITING   5
+#define SCO_STATE_BLOCKED   6
+struct sco_dump_iter {
+    int phase;
+    size_t pos;
+    int64_t last;
+};
+struct sco_dump_info {
+    int64_t id;
+    int state;
+    int priority;
+    void *udata;
+    void *stack;
+    size_t stack_size;
+};
+#define SCO_STACKSIG_DEPTH 24
+struct sco_stack_sig {
+    uint64_t hash;
+    size_t count;
+    int64_t id;
+    int nips;
+    void *ips[SCO_STACKSIG_DEPTH];
+};
 #endif
 
 #ifndef SCO_EXTERN
@@ -42,12 +149,17 @@ struct sco_symbol {
 ////////////////////////////////////////////////////////////////////////////////
 #ifdef SCO_NOAMALGA
 
+// The separately built deps/llco.c needs LLCO_NOFPREGS for SCO_NOFPREGS.
 #include "deps/llco.h"
 
 #else
 
 #define LLCO_STATIC
 
+#if defined(SCO_NOFPREGS) && !defined(LLCO_NOFPREGS)
+#define LLCO_NOFPREGS
+#endif
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -95,6 +207,7 @@ struct llco_symbol {
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef LLCO_VALGRIND
 #include <valgrind/valgrind.h>
@@ -140,6 +253,12 @@ static void llco_exit(void) {
 #define LLCO_NOASM
 #endif
 
+// Defining LLCO_NOFPREGS makes the asm switch skip the callee-saved floating
+// point registers (d8-d15 on arm and aarch64, fs0-fs11 on riscv). Only safe
+// when no floating point values are kept in those registers across a switch.
+// The x64 and i386 switches never save them, and the Windows x64 switch
+// always does.
+
 // Passing the entry function into assembly requires casting the function 
 // pointer to an object pointer, which is forbidden in the ISO C spec but
 // allowed in posix. Ignore the warning attributed to this  requirement when
@@ -187,7 +306,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define LLCO_METHOD "asm,arm_eabi"
 
 struct llco_asmctx {
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     void* f[16];
 #endif
     void *d[4]; /* d8-d15 */
@@ -210,12 +329,12 @@ __asm__(
     ".hidden _llco_asm_switch\n"
     "_llco_asm_switch:\n"
 #endif
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     "  vstmia r0!, {d8-d15}\n"
 #endif
     "  stmia r0, {r4-r11, lr}\n"
     "  str sp, [r0, #9*4]\n"
-#ifndef __SOFTFP__
+#if !defined(__SOFTFP__) && !defined(LLCO_NOFPREGS)
     "  vldmia r1!, {d8-d15}\n"
 #endif
     "  ldr sp, [r1, #9*4]\n"
@@ -291,24 +410,40 @@ __asm__(
     "  mov x11, x30\n"
     "  stp x19, x20, [x0, #(0*16)]\n"
     "  stp x21, x22, [x0, #(1*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d8, d9, [x0, #(7*16)]\n"
+#endif
     "  stp x23, x24, [x0, #(2*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d10, d11, [x0, #(8*16)]\n"
+#endif
     "  stp x25, x26, [x0, #(3*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d12, d13, [x0, #(9*16)]\n"
+#endif
     "  stp x27, x28, [x0, #(4*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  stp d14, d15, [x0, #(10*16)]\n"
+#endif
     "  stp x29, x30, [x0, #(5*16)]\n"
     "  stp x10, x11, [x0, #(6*16)]\n"
     "  ldp x19, x20, [x1, #(0*16)]\n"
     "  ldp x21, x22, [x1, #(1*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d8, d9, [x1, #(7*16)]\n"
+#endif
     "  ldp x23, x24, [x1, #(2*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d10, d11, [x1, #(8*16)]\n"
+#endif
     "  ldp x25, x26, [x1, #(3*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d12, d13, [x1, #(9*16)]\n"
+#endif
     "  ldp x27, x28, [x1, #(4*16)]\n"
+#ifndef LLCO_NOFPREGS
     "  ldp d14, d15, [x1, #(10*16)]\n"
+#endif
     "  ldp x29, x30, [x1, #(5*16)]\n"
     "  ldp x10, x11, [x1, #(6*16)]\n"
     "  mov sp, x10\n"
@@ -361,7 +496,7 @@ struct llco_asmctx {
     void* ra;
     void* pc;
     void* sp;
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     double fs[12]; /* fs0-fs11 */
 #elif __riscv_flen == 32
@@ -406,7 +541,7 @@ __asm__(
     "  sd ra, 0x60(a0)\n"
     "  sd ra, 0x68(a0)\n" /* pc */
     "  sd sp, 0x70(a0)\n"
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     "  fsd fs0, 0x78(a0)\n"
     "  fsd fs1, 0x80(a0)\n"
@@ -468,7 +603,7 @@ __asm__(
     "  sw ra, 0x30(a0)\n"
     "  sw ra, 0x34(a0)\n" /* pc */
     "  sw sp, 0x38(a0)\n"
-#ifdef __riscv_flen
+#if defined(__riscv_flen) && !defined(LLCO_NOFPREGS)
 #if __riscv_flen == 64
     "  fsd fs0, 0x3c(a0)\n"
     "  fsd fs1, 0x44(a0)\n"
@@ -1169,10 +1304,128 @@ const char *llco_method(void *caps) {
     return LLCO_METHOD
 #ifdef LLCO_STACKJMP
         ",stackjmp"
+#endif
+#if defined(LLCO_ASM) && defined(LLCO_NOFPREGS) && !defined(_WIN32) && \
+    ((defined(__ARM_EABI__) && !defined(__SOFTFP__)) || \
+    defined(__aarch64__) || defined(__riscv_flen))
+        // Only these switches save floating point registers.
+        ",nofp"
 #endif
     ;
 }
 
+#if defined(LLCO_ASM) && !defined(_WIN32) && (defined(__x86_64__) || \
+    defined(__i386) || defined(__i386__) || defined(__aarch64__) || \
+    defined(__riscv))
+#define LLCO_BACKTRACE
+#endif
+
+#ifdef LLCO_BACKTRACE
+
+#ifdef __riscv
+// The return address and the caller's frame pointer are stored just below
+// the frame pointer.
+#define LLCO_FRAME_LOW(fp) ((char*)(fp)-2*sizeof(void*))
+#define LLCO_FRAME_NEXT(fp) (((void**)(fp))[-2])
+#define LLCO_FRAME_RA(fp) (((void**)(fp))[-1])
+#else
+#define LLCO_FRAME_LOW(fp) ((char*)(fp))
+#define LLCO_FRAME_NEXT(fp) (((void**)(fp))[0])
+#define LLCO_FRAME_RA(fp) (((void**)(fp))[1])
+#endif
+
+// Follow the chain of frame pointers, starting at the frame of the function
+// that ip returns into, without leaving the stack memory between lo and hi.
+static int llco_walk(char *lo, char *hi, void *fp, void *ip, void *start_ip,
+    void **ips, int max)
+{
+    int n = 0;
+    bool started = !start_ip;
+    while (n < max && ip) {
+        if (!started && ip == start_ip) {
+            started = true;
+        }
+        if (started) {
+            ips[n++] = ip;
+        }
+        if ((uintptr_t)fp % sizeof(void*) || LLCO_FRAME_LOW(fp) < lo ||
+            (char*)fp+2*sizeof(void*) > hi)
+        {
+            break;
+        }
+        void *next = LLCO_FRAME_NEXT(fp);
+        ip = LLCO_FRAME_RA(fp);
+        if ((char*)next <= (char*)fp) {
+            // Frames only move toward the top of the stack.
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
+#endif
+
+// Store up to max return addresses of a coroutine into ips, by following its
+// frame pointers. Use NULL for the current coroutine, in which case nothing
+// is stored until start_ip is found, or any other coroutine that has switched
+// out, which is walked from where it switched. Only the coroutine's own
+// stack memory is read and no locks are taken, so this is safe to call from
+// a signal handler. Frames of code built without frame pointers are skipped.
+// Returns the number of addresses stored, which is zero when the switch
+// method has no frame pointers to follow.
+LLCO_EXTERN
+int llco_backtrace(struct llco *co, void *start_ip, void **ips, int max) {
+#ifdef LLCO_BACKTRACE
+    char *lo, *hi, *fp, *ip;
+    if (!co) {
+        co = llco_cur;
+        if (!co || co == &llco_thread) {
+            return 0;
+        }
+        fp = __builtin_frame_address(0);
+        lo = fp;
+        hi = (char*)co->desc.stack+co->desc.stack_size;
+        if (fp < (char*)co->desc.stack || fp >= hi) {
+            // Still on the stack of the previous coroutine.
+            return 0;
+        }
+        ip = LLCO_FRAME_RA(fp);
+        fp = LLCO_FRAME_NEXT(fp);
+    } else {
+        if (co == llco_cur || co == &llco_thread) {
+            return 0;
+        }
+#if defined(__x86_64__)
+        lo = co->ctx.rsp;
+        fp = co->ctx.rbp;
+        ip = *(void**)co->ctx.rsp;
+#elif defined(__i386) || defined(__i386__)
+        lo = co->ctx.esp;
+        fp = co->ctx.ebp;
+        ip = *(void**)co->ctx.esp;
+#elif defined(__aarch64__)
+        lo = co->ctx.sp;
+        fp = co->ctx.x[10];
+        ip = co->ctx.x[11];
+#else
+        lo = co->ctx.sp;
+        fp = co->ctx.s[0];
+        ip = co->ctx.ra;
+#endif
+        hi = (char*)co->desc.stack+co->desc.stack_size;
+        if (lo < (char*)co->desc.stack || lo >= hi) {
+            return 0;
+        }
+        start_ip = 0;
+    }
+    return llco_walk(lo, hi, fp, ip, start_ip, ips, max);
+#else
+    (void)co, (void)start_ip, (void)ips, (void)max;
+    return 0;
+#endif
+}
+
 #if defined(__GNUC__) && !defined(__EMSCRIPTEN__) && !defined(_WIN32) && \
     !defined(LLCO_NOUNWIND) && !defined(__COSMOCC__)
 
@@ -1191,6 +1444,46 @@ struct llco_dlinfo {
 int dladdr(const void *, void *);
 #endif
 
+#ifndef LLCO_SYMCACHE
+#define LLCO_SYMCACHE 256 // number of cached dladdr results, per thread
+#endif
+
+struct llco_symcache_entry {
+    void *ip;
+    bool found;
+    struct llco_dlinfo dlinfo;
+};
+
+static __thread struct llco_symcache_entry llco_symcache[LLCO_SYMCACHE];
+
+// Same as dladdr(), but remembers the result for each instruction pointer.
+// Unloading a shared object with dlclose() is not noticed, which is fine for
+// the code that stays loaded in programs that are being profiled.
+static bool llco_dladdr(void *ip, struct llco_dlinfo *dlinfo) {
+    uintptr_t h = (uintptr_t)ip;
+    h ^= h >> 17;
+    h *= 0x9e3779b1;
+    h ^= h >> 11;
+    struct llco_symcache_entry *entry = &llco_symcache[h % LLCO_SYMCACHE];
+    if (entry->ip != ip) {
+        memset(&entry->dlinfo, 0, sizeof(struct llco_dlinfo));
+        entry->found = dladdr(ip, (void*)&entry->dlinfo) != 0;
+        entry->ip = ip;
+    }
+    *dlinfo = entry->dlinfo;
+    return entry->found;
+}
+
+static void llco_fillsymbol(void *ip, struct llco_symbol *sym) {
+    struct llco_dlinfo dlinfo;
+    if (ip && llco_dladdr(ip, &dlinfo)) {
+        sym->fname = dlinfo.dli_fname;
+        sym->fbase = dlinfo.dli_fbase;
+        sym->sname = dlinfo.dli_sname;
+        sym->saddr = dlinfo.dli_saddr;
+    }
+}
+
 static void llco_getsymbol(struct _Unwind_Context *uwc, 
     struct llco_symbol *sym)
 {
@@ -1198,13 +1491,17 @@ static void llco_getsymbol(struct _Unwind_Context *uwc,
     sym->cfa = (void*)_Unwind_GetCFA(uwc);
     int ip_before; /* unused */
     sym->ip = (void*)_Unwind_GetIPInfo(uwc, &ip_before);
-    struct llco_dlinfo dlinfo = { 0 };
-    if (sym->ip && dladdr(sym->ip, (void*)&dlinfo)) {
-        sym->fname = dlinfo.dli_fname;
-        sym->fbase = dlinfo.dli_fbase;
-        sym->sname = dlinfo.dli_sname;
-        sym->saddr = dlinfo.dli_saddr;
-    }
+    llco_fillsymbol(sym->ip, sym);
+}
+
+// Look up the symbol of an instruction pointer, such as one that was returned
+// by llco_backtrace(). The cfa field is not set.
+LLCO_EXTERN
+bool llco_symbolize(void *ip, struct llco_symbol *sym) {
+    memset(sym, 0, sizeof(struct llco_symbol));
+    sym->ip = ip;
+    llco_fillsymbol(ip, sym);
+    return sym->sname || sym->fname;
 }
 
 struct llco_unwind_context {
@@ -1274,6 +1571,13 @@ int llco_unwind(bool(*func)(struct llco_symbol *sym, void *udata), void *udata){
     return 0;
 }
 
+LLCO_EXTERN
+bool llco_symbolize(void *ip, struct llco_symbol *sym) {
+    (void)ip; (void)sym;
+    /* Unsupported */
+    return false;
+}
+
 #endif
 // END llco.c
 
@@ -1677,6 +1981,26 @@ struct sco {
     int64_t id;
     void *udata;
     struct llco *llco;
+    void *stack;
+    size_t stack_size;
+    int64_t deadline;     // sleep deadline, zero if not sleeping
+    struct sco *tnext;    // next in timer slot
+    struct sco **tpprev;  // previous link in timer slot
+    uint8_t tlevel;       // timer wheel level
+    uint8_t tslot;        // timer wheel slot
+    uint8_t prio;         // run queue level
+#ifdef SCO_STATS
+    int64_t queued;       // time when added to the run queue
+    int64_t cputime;      // time spent running, excluding the current slice
+#endif
+    struct sco *wnext;  // next in a wait queue
+    struct sco_group *group; // see sco_group_wait()
+    uint64_t gen;  // resume handle generation
+    bool pooled;   // started from a pool thread
+    bool handled;  // next pause is resumable by handle
+    bool hpaused;  // paused in the handle list
+    bool dumpmark; // the cursor of a batched dump, see sco_dump_list()
+    bool done;     // torn down, see sco_teardown()
 };
 
 static int sco_compare(struct sco *a, struct sco *b) {
@@ -1718,6 +2042,121 @@ static uint64_t sco_mix13(uint64_t key) {
 #define SCO_NSHARDS 512
 #endif
 
+// Define SCO_HASHMAP to store the paused coroutines in an open-addressing 
+// hashmap instead. Lookups become constant time at the expense of the map 
+// allocating its table from the heap.
+#ifdef SCO_HASHMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef SCO_HASHMAP_MINCAP
+#define SCO_HASHMAP_MINCAP 64 // must be a power of two
+#endif
+
+struct sco_bucket {
+    int64_t id; // zero for an empty bucket
+    struct sco *co;
+};
+
+struct sco_map {
+    struct sco_bucket *buckets;
+    size_t cap;
+    int count;
+};
+
+static void sco_map_resize(struct sco_map *map, size_t cap) {
+    struct sco_bucket *buckets = calloc(cap, sizeof(struct sco_bucket));
+    if (!buckets) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->buckets[i].id) {
+            size_t j = sco_mix13(map->buckets[i].id) & (cap-1);
+            while (buckets[j].id) {
+                j = (j+1) & (cap-1);
+            }
+            buckets[j] = map->buckets[i];
+        }
+    }
+    free(map->buckets);
+    map->buckets = buckets;
+    map->cap = cap;
+}
+
+static struct sco *sco_map_insert(struct sco_map *map, struct sco *sco) {
+    if ((size_t)(map->count+1)*4 > map->cap*3) {
+        sco_map_resize(map, map->cap ? map->cap*2 : SCO_HASHMAP_MINCAP);
+    }
+    size_t mask = map->cap-1;
+    size_t i = sco_mix13(sco->id) & mask;
+    while (map->buckets[i].id) {
+        if (map->buckets[i].id == sco->id) {
+            struct sco *prev = map->buckets[i].co;
+            map->buckets[i].co = sco;
+            return prev;
+        }
+        i = (i+1) & mask;
+    }
+    map->buckets[i].id = sco->id;
+    map->buckets[i].co = sco;
+    map->count++;
+    return NULL;
+}
+
+static struct sco *sco_map_delete(struct sco_map *map, struct sco *key) {
+    if (map->count == 0) {
+        return NULL;
+    }
+    size_t mask = map->cap-1;
+    size_t i = sco_mix13(key->id) & mask;
+    while (map->buckets[i].id != key->id) {
+        if (!map->buckets[i].id) {
+            return NULL;
+        }
+        i = (i+1) & mask;
+    }
+    struct sco *prev = map->buckets[i].co;
+    // Backward shift the following buckets to fill the hole.
+    size_t j = i;
+    while (1) {
+        j = (j+1) & mask;
+        if (!map->buckets[j].id) {
+            break;
+        }
+        size_t k = sco_mix13(map->buckets[j].id) & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            map->buckets[i] = map->buckets[j];
+            i = j;
+        }
+    }
+    map->buckets[i].id = 0;
+    map->buckets[i].co = NULL;
+    map->count--;
+    if (map->cap > SCO_HASHMAP_MINCAP && (size_t)map->count*8 < map->cap) {
+        sco_map_resize(map, map->cap/2);
+    }
+    return prev;
+}
+
+static struct sco *sco_map_search(struct sco_map *map, struct sco *key) {
+    if (map->count == 0) {
+        return NULL;
+    }
+    size_t mask = map->cap-1;
+    size_t i = sco_mix13(key->id) & mask;
+    while (map->buckets[i].id != key->id) {
+        if (!map->buckets[i].id) {
+            return NULL;
+        }
+        i = (i+1) & mask;
+    }
+    return map->buckets[i].co;
+}
+
+#else
+
 struct sco_map {
     struct sco *roots[SCO_NSHARDS];
     int count;
@@ -1742,41 +2181,213 @@ static struct sco *sco_map_delete(struct sco_map *map, struct sco *key){
     return prev;
 }
 
+static struct sco *sco_map_search(struct sco_map *map, struct sco *key){
+    return sco_aat_search(scp_map_getaat(key), key);
+}
+
+#endif
+
 struct sco_list {
     struct sco_link head;
     struct sco_link tail;
+    uint64_t gen;  // bumped when all of the coroutines move to another list
+};
+
+#ifdef SCO_RINGQ
+// A run queue that is a growable ring of coroutine pointers. Pushing and
+// popping don't touch the neighbouring coroutines, each of which is at the
+// top of its own stack, so a long queue doesn't cost a cold page per link.
+struct sco_queue {
+    struct sco **slots;
+    size_t cap;   // zero or a power of two
+    size_t head;
+    size_t tail;  // head plus the number of coroutines
+};
+#else
+// A run queue that is linked through the coroutines.
+struct sco_queue {
+    struct sco_list list;
 };
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Global and thread-local variables.
 ////////////////////////////////////////////////////////////////////////////////
 
-static __thread bool sco_initialized = false;
-static __thread size_t sco_nrunners = 0;
-static __thread struct sco_list sco_runners = { 0 };
-static __thread size_t sco_nyielders = 0;
-static __thread struct sco_list sco_yielders = { 0 };
-static __thread struct sco *sco_cur = NULL;
-static __thread struct sco_map sco_paused = { 0 };
-static __thread size_t sco_npaused = 0;
-static __thread bool sco_exit_to_main_requested = false;
+// Each priority level has its own runners and yielders. The skipped field
+// counts how many times a level with runners was passed over for a higher
+// one.
+struct sco_runq {
+    size_t nrunners;
+    struct sco_queue runners;
+    size_t nyielders;
+    struct sco_queue yielders;
+    unsigned skipped;
+};
+
+#define SCO_NPRIOS (SCO_PRIO_HIGH-SCO_PRIO_LOW+1)
+
+#ifndef SCO_TIMER_TICK
+#define SCO_TIMER_TICK 1000000 // nanoseconds per tick
+#endif
+
+#ifndef SCO_TIMER_LEVELS
+#define SCO_TIMER_LEVELS 4
+#endif
+
+// The timer wheel, see sco_sleep().
+struct sco_wheel {
+    int64_t now;  // last processed tick
+    size_t count;
+    uint64_t bitmaps[SCO_TIMER_LEVELS];
+    struct sco *slots[SCO_TIMER_LEVELS][64];
+};
+
+struct sco_inbox;
+
+// The state of one scheduler, with the fields used by every switch first.
+// Each thread has a default scheduler and may switch to others with
+// sco_sched_set(). The sco_* names below are shorthands for the fields of
+// the calling thread's current scheduler, much like errno.
+struct sco_sched {
+    _Alignas(64) struct sco *cur;
+    size_t nrunners;   // runners in all levels
+    size_t nyielders;  // yielders in all levels
+    size_t npaused;
+    bool initialized;
+    bool exit_to_main_requested;
+    int rec_mode;      // SCO_RECORDING or SCO_REPLAYING
+    bool multilevel;   // a level other than normal has been used
+    int64_t quantum;   // ticks or nanoseconds, zero for none
+    int64_t quantum_mark; // tick or time that the slice began
+    struct sco_runq runqs[SCO_NPRIOS];
+    struct sco_list hpaused;
+    struct sco_list blocked; // in wait queues
+    int pollfd;
+    size_t nwaiting;
+    struct sco_inbox *inbox; // see sco_inbox_open()
+    uint64_t *rec_ring;
+    size_t rec_mask;
+    uint64_t rec_total;      // events recorded since start
+    const uint64_t *replay_log;
+    size_t replay_n;
+    size_t replay_pos;
+    struct sco *dump_cursor;    // where the batched list dump continues
+    struct sco_list *dump_list; // the list of the dump cursor
+    uint64_t dump_list_gen;     // the gen of dump_list when it was set
+    int64_t dump_token;         // the iterator that set the cursor
+#ifdef SCO_STATS
+    struct sco_stats stats;
+    int64_t slice_start;
+    int64_t slice_budget;
+    void (*slice_hook)(int64_t id, int64_t slice, void *udata);
+    void *slice_udata;
+#endif
+    struct sco_map paused;
+    struct sco_wheel timers;
+};
+
+#if defined(__GNUC__)
+#define sco_likely(x) __builtin_expect(!!(x), 1)
+#define sco_unlikely(x) __builtin_expect(!!(x), 0)
+#define sco_cold __attribute__((noinline, cold))
+#else
+#define sco_likely(x) (x)
+#define sco_unlikely(x) (x)
+#define sco_cold
+#endif
+
+static __thread struct sco_sched sco_tsched = { .pollfd = -1 };
+static __thread struct sco_sched *sco_tsp = NULL; // current scheduler
+
+// The address of a thread-local is not a constant initializer, so the
+// pointer to the thread's default scheduler is set on first use.
+static sco_cold struct sco_sched *sco_sched_default(void) {
+    sco_tsp = &sco_tsched;
+    return sco_tsp;
+}
+
+#define sco_S (sco_likely(sco_tsp) ? sco_tsp : sco_sched_default())
+
+#define sco_initialized (sco_S->initialized)
+#define sco_runqs (sco_S->runqs)
+#define sco_nrunners (sco_S->nrunners)
+#define sco_nyielders (sco_S->nyielders)
+#define sco_cur (sco_S->cur)
+#define sco_paused (sco_S->paused)
+#define sco_npaused (sco_S->npaused)
+#define sco_hpaused (sco_S->hpaused)
+#define sco_blocked (sco_S->blocked)
+#define sco_exit_to_main_requested (sco_S->exit_to_main_requested)
+#define sco_pollfd (sco_S->pollfd)
+#define sco_nwaiting (sco_S->nwaiting)
+#define sco_tinbox (sco_S->inbox)
+#define sco_timers (sco_S->timers)
+#define sco_rec_mode (sco_S->rec_mode)
+#define sco_rec_ring (sco_S->rec_ring)
+#define sco_rec_mask (sco_S->rec_mask)
+#define sco_rec_total (sco_S->rec_total)
+#define sco_replay_log (sco_S->replay_log)
+#define sco_replay_n (sco_S->replay_n)
+#define sco_replay_pos (sco_S->replay_pos)
+#define sco_quantum (sco_S->quantum)
+#define sco_quantum_mark (sco_S->quantum_mark)
+#define sco_tstats (sco_S->stats)
+#define sco_slice_start (sco_S->slice_start)
+#define sco_slice_budget (sco_S->slice_budget)
+#define sco_slice_hook (sco_S->slice_hook)
+#define sco_slice_udata (sco_S->slice_udata)
+
 static __thread void(*sco_user_entry)(void *udata);
+static __thread void *sco_user_stack;
+static __thread int sco_user_priority;
+static __thread struct sco_group *sco_user_group;
+static __thread size_t sco_user_stack_size;
 
 static atomic_int_fast64_t sco_next_id = 0;
-static atomic_bool sco_locker = 0;
-static struct sco_map sco_detached = { 0 };
-static size_t sco_ndetached = 0;
 
-static void sco_lock(void) {
+// The detached coroutines are stored in hashed shards, each with its own
+// lock, so threads moving different coroutines rarely contend.
+struct sco_shard {
+    _Alignas(64) atomic_bool lock;
+    struct sco *root;
+};
+
+// One shard per cache line.
+_Static_assert(sizeof(struct sco_shard) == 64, "sco_shard is not 64 bytes");
+
+static struct sco_shard sco_detached[SCO_NSHARDS];
+static atomic_size_t sco_ndetached = 0;
+
+static struct sco_shard *sco_shard(int64_t id) {
+    return &sco_detached[sco_mix13(id) & (SCO_NSHARDS-1)];
+}
+
+static int64_t sco_clock(void);
+
+static void sco_lock(struct sco_shard *shard) {
     bool expected = false;
-    while(!atomic_compare_exchange_weak(&sco_locker, &expected, true)) {
+    if (atomic_compare_exchange_weak(&shard->lock, &expected, true)) {
+        return;
+    }
+#ifdef SCO_STATS
+    int64_t start = sco_clock();
+#endif
+    expected = false;
+    while(!atomic_compare_exchange_weak(&shard->lock, &expected, true)) {
         expected = false;
-        sched_yield0();
+        while (atomic_load_explicit(&shard->lock, memory_order_relaxed)) {
+            sched_yield0();
+        }
     }
+#ifdef SCO_STATS
+    sco_tstats.lock_waits++;
+    sco_tstats.lock_wait_ns += (uint64_t)(sco_clock()-start);
+#endif
 }
 
-static void sco_unlock(void) {
-    atomic_store(&sco_locker, false);
+static void sco_unlock(struct sco_shard *shard) {
+    atomic_store(&shard->lock, false);
 }
 
 static void sco_list_init(struct sco_list *list) {
@@ -1787,30 +2398,44 @@ static void sco_list_init(struct sco_list *list) {
 }
 
 // Remove the coroutine from the runners or yielders list.
+// The dump cursor is leaving its list. The next coroutine takes over, unless
+// the whole list has moved elsewhere since the cursor was set.
+static sco_cold void sco_dump_advance(struct sco *co) {
+    struct sco_sched *S = sco_S;
+    co->dumpmark = false;
+    S->dump_cursor = NULL;
+    if (S->dump_list->gen == S->dump_list_gen) {
+        S->dump_cursor = co->next;
+        if (co->next != (struct sco*)&S->dump_list->tail) {
+            co->next->dumpmark = true;
+        }
+    }
+}
+
 static void sco_remove_from_list(struct sco *co) {
+    if (sco_unlikely(co->dumpmark)) {
+        sco_dump_advance(co);
+    }
     co->prev->next = co->next;
     co->next->prev = co->prev;
     co->next = co;
     co->prev = co;
 }
 
+static void sco_queue_init(struct sco_queue *q);
+
 static void sco_init(void) {
     if (!sco_initialized) {
-        sco_list_init(&sco_runners);
-        sco_list_init(&sco_yielders);
+        for (int i = 0; i < SCO_NPRIOS; i++) {
+            sco_queue_init(&sco_runqs[i].runners);
+            sco_queue_init(&sco_runqs[i].yielders);
+        }
+        sco_list_init(&sco_hpaused);
+        sco_list_init(&sco_blocked);
         sco_initialized = true;
     }
 }
 
-static struct sco *sco_list_pop_front(struct sco_list *list) {
-    struct sco *co = NULL;
-    if (list->head.next != (struct sco*)&list->tail) {
-        co = list->head.next;
-        sco_remove_from_list(co);
-    }
-    return co;
-}
-
 static void sco_list_push_back(struct sco_list *list, struct sco *co) {
     sco_remove_from_list(co);
     list->tail.prev->next = co;
@@ -1819,148 +2444,2419 @@ static void sco_list_push_back(struct sco_list *list, struct sco *co) {
     list->tail.prev = co;
 }
 
-static void sco_return_to_main(bool final) {
-    sco_cur = NULL;
-    sco_exit_to_main_requested = false;
-    llco_switch(0, final);
+#ifdef SCO_RINGQ
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef SCO_RINGQ_PREFETCH
+#define SCO_RINGQ_PREFETCH 4
+#endif
+
+#if defined(__GNUC__)
+#define sco_prefetch(p) __builtin_prefetch(p)
+#else
+#define sco_prefetch(p) (void)(p)
+#endif
+
+static void sco_queue_init(struct sco_queue *q) {
+    (void)q;
 }
 
-static void sco_switch(bool resumed_from_main, bool final) {
-    if (sco_nrunners == 0) {
-        // No more runners.
-        if (sco_nyielders == 0 || sco_exit_to_main_requested ||
-            (!resumed_from_main && sco_npaused > 0)) {
-            sco_return_to_main(final);
-            return;
-        }
-        // Convert the yielders to runners
-        sco_runners.head.next = sco_yielders.head.next;
-        sco_runners.head.next->prev = (struct sco*)&sco_runners.head;
-        sco_runners.tail.prev = sco_yielders.tail.prev;
-        sco_runners.tail.prev->next = (struct sco*)&sco_runners.tail;
-        sco_yielders.head.next = (struct sco*)&sco_yielders.tail;
-        sco_yielders.tail.prev = (struct sco*)&sco_yielders.head;
-        sco_nrunners = sco_nyielders;
-        sco_nyielders = 0;
-    }
-    sco_cur = sco_list_pop_front(&sco_runners);
-    sco_nrunners--;
-    llco_switch(sco_cur->llco, final);
+static size_t sco_queue_count(struct sco_queue *q) {
+    return q->tail-q->head;
 }
 
-static void sco_entry(void *udata) {
-    // Initialize a new coroutine on the user's stack.
-    struct sco scostk = { 0 };
-    struct sco *co = &scostk;
-    co->llco = llco_current();
-    co->id = atomic_fetch_add(&sco_next_id, 1) + 1;
-    co->udata = udata;
-    co->prev = co;
-    co->next = co;
-    if (sco_cur) {
-        // Reschedule the coroutine that started this one immediately after
-        // all running coroutines, but before any yielding coroutines, and
-        // continue running the started coroutine.
-        sco_list_push_back(&sco_runners, sco_cur);
-        sco_nrunners++;
+static struct sco *sco_queue_at(struct sco_queue *q, size_t i) {
+    return q->slots[(q->head+i)&(q->cap-1)];
+}
+
+static void sco_queue_grow(struct sco_queue *q) {
+    size_t cap = q->cap == 0 ? 64 : q->cap*2;
+    struct sco **slots = malloc(cap*sizeof(struct sco*));
+    if (!slots) {
+        fprintf(stderr, "out of memory\n");
+        abort();
     }
-    sco_cur = co;
-    if (sco_user_entry) {
-        sco_user_entry(udata);
+    size_t count = sco_queue_count(q);
+    for (size_t i = 0; i < count; i++) {
+        slots[i] = sco_queue_at(q, i);
     }
-    // This coroutine is finished. Switch to the next coroutine.
-    sco_switch(false, true);
+    free(q->slots);
+    q->slots = slots;
+    q->cap = cap;
+    q->head = 0;
+    q->tail = count;
 }
 
-SCO_EXTERN
-void sco_exit(void) {
-    if (sco_cur) {
-        sco_exit_to_main_requested = true;
-        sco_switch(false, true);
+static void sco_queue_push(struct sco_queue *q, struct sco *co) {
+    if (sco_queue_count(q) == q->cap) {
+        sco_queue_grow(q);
     }
+    q->slots[q->tail++&(q->cap-1)] = co;
 }
 
-SCO_EXTERN
-void sco_start(struct sco_desc *desc) {
-    sco_init();
-    struct llco_desc llco_desc = {
-        .entry = sco_entry,
-        .cleanup = desc->cleanup,
-        .stack = desc->stack,
-        .stack_size = desc->stack_size,
-        .udata = desc->udata,
-    };
-    sco_user_entry = desc->entry;
-    llco_start(&llco_desc, false);
+static struct sco *sco_queue_pop(struct sco_queue *q) {
+    if (q->head == q->tail) {
+        return NULL;
+    }
+    size_t mask = q->cap-1;
+    if (q->tail-q->head > SCO_RINGQ_PREFETCH) {
+        // Start loading a coroutine that runs soon.
+        sco_prefetch(q->slots[(q->head+SCO_RINGQ_PREFETCH)&mask]);
+    }
+    return q->slots[q->head++&mask];
 }
 
-SCO_EXTERN
-int64_t sco_id(void) {
+// Move all of the src coroutines to the back of dst.
+static void sco_queue_splice(struct sco_queue *dst, struct sco_queue *src) {
+    if (dst->head == dst->tail) {
+        // Usually the case, when a round of runners is done.
+        struct sco_queue tmp = *dst;
+        *dst = *src;
+        *src = tmp;
+        src->head = src->tail = 0;
+        return;
+    }
+    struct sco *co;
+    while ((co = sco_queue_pop(src))) {
+        sco_queue_push(dst, co);
+    }
+}
+
+// Remove and return the coroutine with the id, or NULL if it's not there.
+static struct sco *sco_queue_take(struct sco_queue *q, int64_t id) {
+    size_t count = sco_queue_count(q);
+    for (size_t i = 0; i < count; i++) {
+        struct sco *co = sco_queue_at(q, i);
+        if (co->id != id) {
+            continue;
+        }
+        // Close the gap, keeping the order of the others.
+        for (size_t j = i; j > 0; j--) {
+            q->slots[(q->head+j)&(q->cap-1)] = sco_queue_at(q, j-1);
+        }
+        q->head++;
+        return co;
+    }
+    return NULL;
+}
+
+static void sco_queue_free(struct sco_queue *q) {
+    free(q->slots);
+}
+
+#else
+
+static struct sco *sco_list_pop_front(struct sco_list *list) {
+    struct sco *co = NULL;
+    if (list->head.next != (struct sco*)&list->tail) {
+        co = list->head.next;
+        sco_remove_from_list(co);
+    }
+    return co;
+}
+
+static void sco_queue_init(struct sco_queue *q) {
+    sco_list_init(&q->list);
+}
+
+static void sco_queue_push(struct sco_queue *q, struct sco *co) {
+    sco_list_push_back(&q->list, co);
+}
+
+static struct sco *sco_queue_pop(struct sco_queue *q) {
+    return sco_list_pop_front(&q->list);
+}
+
+// Move all of the src coroutines to the back of dst.
+static void sco_queue_splice(struct sco_queue *dst, struct sco_queue *src) {
+    struct sco_list *a = &dst->list;
+    struct sco_list *b = &src->list;
+    if (b->head.next == (struct sco*)&b->tail) {
+        return;
+    }
+    a->tail.prev->next = b->head.next;
+    a->tail.prev->next->prev = a->tail.prev;
+    a->tail.prev = b->tail.prev;
+    a->tail.prev->next = (struct sco*)&a->tail;
+    b->head.next = (struct sco*)&b->tail;
+    b->tail.prev = (struct sco*)&b->head;
+    b->gen++;
+}
+
+// Remove and return the coroutine with the id, or NULL if it's not there.
+static struct sco *sco_queue_take(struct sco_queue *q, int64_t id) {
+    struct sco *end = (struct sco*)&q->list.tail;
+    for (struct sco *co = q->list.head.next; co != end; co = co->next) {
+        if (co->id == id) {
+            sco_remove_from_list(co);
+            return co;
+        }
+    }
+    return NULL;
+}
+
+static void sco_queue_free(struct sco_queue *q) {
+    (void)q;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Tracing. With SCO_USDT the scheduler events are USDT probes of the "sco"
+// provider, which perf and bpftrace can attach to. Until then each probe is
+// a single nop. The same events go to the recorder, see sco_record_start().
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef SCO_USDT
+#include <sys/sdt.h>
+#define sco_usdt1(name, a) DTRACE_PROBE1(sco, name, a)
+#define sco_usdt2(name, a, b) DTRACE_PROBE2(sco, name, a, b)
+#else
+#define sco_usdt1(name, a)
+#define sco_usdt2(name, a, b)
+#endif
+
+#include <stdlib.h>
+
+#define SCO_RECORDING 1
+#define SCO_REPLAYING 2
+
+static void sco_record0(int type, int64_t id) {
+    uint64_t ev = (uint64_t)type<<56 | ((uint64_t)id&SCO_EVENT_IDMASK);
+    if (sco_rec_mode == SCO_RECORDING) {
+        sco_rec_ring[sco_rec_total&sco_rec_mask] = ev;
+        sco_rec_total++;
+    } else if (sco_replay_log[sco_replay_pos] == ev) {
+        sco_replay_pos++;
+        if (sco_replay_pos == sco_replay_n) {
+            // Replay complete.
+            sco_rec_mode = 0;
+        }
+    } else {
+        // Diverged from the log. Carry on with the normal schedule.
+        sco_rec_mode = 0;
+    }
+}
+
+#define sco_event_start  SCO_EVENT_START
+#define sco_event_switch SCO_EVENT_SWITCH
+#define sco_event_pause  SCO_EVENT_PAUSE
+#define sco_event_resume SCO_EVENT_RESUME
+#define sco_event_detach SCO_EVENT_DETACH
+#define sco_event_attach SCO_EVENT_ATTACH
+#define sco_event_exit   SCO_EVENT_EXIT
+
+#define sco_probe1(name, a) do { \
+    sco_usdt1(name, a); \
+    if (sco_rec_mode) sco_record0(sco_event_##name, (a)); \
+} while (0)
+
+// Events that are only recorded, without a USDT probe of their own.
+#define sco_record1(type, a) do { \
+    if (sco_rec_mode) sco_record0((type), (a)); \
+} while (0)
+
+// Only the second argument, the coroutine switched to, is recorded.
+#define sco_probe2(name, a, b) do { \
+    sco_usdt2(name, a, b); \
+    if (sco_rec_mode) sco_record0(sco_event_##name, (b)); \
+} while (0)
+
+// Take the coroutine that the replay log switches to next from anywhere in
+// the run queues, or return NULL if it's not there.
+static struct sco *sco_replay_take(void) {
+    uint64_t ev = sco_replay_log[sco_replay_pos];
+    if (SCO_EVENT_TYPE(ev) != SCO_EVENT_SWITCH) {
+        return NULL;
+    }
+    int64_t id = SCO_EVENT_ID(ev);
+    for (int i = SCO_NPRIOS-1; i >= 0; i--) {
+        struct sco_runq *rq = &sco_runqs[i];
+        struct sco *co = sco_queue_take(&rq->runners, id);
+        if (co) {
+            rq->nrunners--;
+            sco_nrunners--;
+            return co;
+        }
+        co = sco_queue_take(&rq->yielders, id);
+        if (co) {
+            rq->nyielders--;
+            sco_nyielders--;
+            return co;
+        }
+    }
+    return NULL;
+}
+
+SCO_EXTERN
+bool sco_record_start(size_t cap) {
+    if (sco_rec_mode) {
+        return false;
+    }
+    size_t size = 1;
+    while (size < cap) {
+        size *= 2;
+    }
+    uint64_t *ring = malloc(size*sizeof(uint64_t));
+    if (!ring) {
+        return false;
+    }
+    free(sco_rec_ring);
+    sco_rec_ring = ring;
+    sco_rec_mask = size-1;
+    sco_rec_total = 0;
+    sco_rec_mode = SCO_RECORDING;
+    return true;
+}
+
+SCO_EXTERN
+size_t sco_record_get(uint64_t *events, size_t n) {
+    if (!sco_rec_ring) {
+        return 0;
+    }
+    uint64_t count = sco_rec_total;
+    if (count > sco_rec_mask+1) {
+        count = sco_rec_mask+1;
+    }
+    if (count > n) {
+        count = n;
+    }
+    uint64_t start = sco_rec_total-count;
+    for (uint64_t i = 0; i < count; i++) {
+        events[i] = sco_rec_ring[(start+i)&sco_rec_mask];
+    }
+    return (size_t)count;
+}
+
+SCO_EXTERN
+void sco_record_stop(void) {
+    if (sco_rec_mode == SCO_RECORDING) {
+        sco_rec_mode = 0;
+    }
+    free(sco_rec_ring);
+    sco_rec_ring = NULL;
+    sco_rec_mask = 0;
+    sco_rec_total = 0;
+}
+
+SCO_EXTERN
+bool sco_replay_start(const uint64_t *events, size_t n) {
+    if (sco_rec_mode || n == 0) {
+        return false;
+    }
+    sco_replay_log = events;
+    sco_replay_n = n;
+    sco_replay_pos = 0;
+    sco_rec_mode = SCO_REPLAYING;
+    return true;
+}
+
+SCO_EXTERN
+bool sco_replaying(void) {
+    return sco_rec_mode == SCO_REPLAYING;
+}
+
+SCO_EXTERN
+size_t sco_replay_stop(void) {
+    size_t pos = sco_replay_pos;
+    if (sco_rec_mode == SCO_REPLAYING) {
+        sco_rec_mode = 0;
+    }
+    sco_replay_log = NULL;
+    sco_replay_n = 0;
+    sco_replay_pos = 0;
+    return pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Yield points. While any scheduler has a quantum, a ticker thread advances
+// sco_epoch every SCO_QUANTUM_TICK nanoseconds. Each switch notes the epoch,
+// and sco_maybe_yield() only yields once a quantum's worth of ticks have
+// passed, which until then costs a load and a compare. Without threads the
+// clock is read instead.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_QUANTUM_TICK
+#define SCO_QUANTUM_TICK 1000000 // nanoseconds per tick
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && !defined(SCO_NOTICKER)
+#define SCO_TICKER
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#ifdef SCO_TICKER
+
+static atomic_int_fast64_t sco_epoch = 0;
+static pthread_mutex_t sco_ticker_lock = PTHREAD_MUTEX_INITIALIZER;
+static int sco_ticker_users = 0;   // schedulers with a quantum
+static bool sco_ticker_running = false;
+
+static void *sco_ticker(void *arg) {
+    (void)arg;
+    struct timespec tick = { 0, SCO_QUANTUM_TICK };
+    while (1) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&sco_ticker_lock);
+        if (sco_ticker_users == 0) {
+            sco_ticker_running = false;
+            pthread_mutex_unlock(&sco_ticker_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&sco_ticker_lock);
+        atomic_fetch_add_explicit(&sco_epoch, 1, memory_order_relaxed);
+    }
+}
+
+// Add or remove a user of the ticker, starting it for the first one.
+// Returns false if the ticker thread could not be started.
+static bool sco_ticker_use(int delta) {
+    bool ok = true;
+    pthread_mutex_lock(&sco_ticker_lock);
+    sco_ticker_users += delta;
+    if (sco_ticker_users > 0 && !sco_ticker_running) {
+        pthread_attr_t attr;
+        pthread_t th;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&th, &attr, sco_ticker, NULL) == 0) {
+            sco_ticker_running = true;
+        } else {
+            sco_ticker_users -= delta;
+            ok = false;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&sco_ticker_lock);
+    return ok;
+}
+
+static int64_t sco_quantum_now(void) {
+    return atomic_load_explicit(&sco_epoch, memory_order_relaxed);
+}
+
+#else
+
+static bool sco_ticker_use(int delta) {
+    (void)delta;
+    return true;
+}
+
+static int64_t sco_quantum_now(void) {
+    return sco_clock();
+}
+
+#endif
+
+static void sco_quantum_begin(void) {
+    if (sco_quantum) {
+        sco_quantum_mark = sco_quantum_now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics. Per-thread counters that are only compiled in with SCO_STATS,
+// otherwise the sco_stat macros do nothing.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef SCO_STATS
+
+#define sco_stat(name) (sco_tstats.name++)
+
+static void sco_stat_queued(struct sco *co) {
+    co->queued = sco_clock();
+}
+
+// Record the time that the coroutine waited in the run queue.
+static void sco_stat_dequeued(struct sco *co) {
+    int64_t ns = sco_clock() - co->queued;
+    uint64_t wait = ns > 0 ? (uint64_t)ns : 0;
+    int bucket = 0;
+    while (bucket < SCO_STATS_NBUCKETS-1 && (wait>>bucket) > 0) {
+        bucket++;
+    }
+    sco_tstats.waits++;
+    sco_tstats.wait_ns += wait;
+    sco_tstats.wait_hist[bucket]++;
+}
+
+static void sco_slice_begin(void) {
+    sco_slice_start = sco_clock();
+    sco_quantum_begin();
+}
+
+// End the run slice of the current coroutine. This is called on the
+// coroutine's stack before it switches out, thus the hook may unwind it.
+static void sco_slice_end(struct sco *co) {
+    int64_t slice = sco_clock() - sco_slice_start;
+    co->cputime += slice;
+    if (sco_slice_hook && slice > sco_slice_budget) {
+        sco_slice_hook(co->id, slice, sco_slice_udata);
+    }
+}
+
+#else
+
+#define sco_stat(name)
+#define sco_stat_queued(co)
+#define sco_stat_dequeued(co)
+#define sco_slice_begin() sco_quantum_begin()
+#define sco_slice_end(co)
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Priority levels. Every level is scheduled in rounds, like the single queue
+// was, so the order within a level is unchanged. A level that is passed over
+// SCO_PRIO_STARVE times in a row gets the next turn.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_PRIO_STARVE
+#define SCO_PRIO_STARVE 16
+#endif
+
+static uint8_t sco_prio_index(int priority) {
+    priority = priority < SCO_PRIO_LOW ? SCO_PRIO_LOW :
+               priority > SCO_PRIO_HIGH ? SCO_PRIO_HIGH : priority;
+    return (uint8_t)(priority-SCO_PRIO_LOW);
+}
+
+#define SCO_LEVEL_NORMAL (SCO_PRIO_NORMAL-SCO_PRIO_LOW)
+
+// Until a coroutine outside of the normal level is queued, the scheduler
+// only looks at the normal level.
+static void sco_use_level(struct sco *co) {
+    if (co->prio != SCO_LEVEL_NORMAL) {
+        sco_S->multilevel = true;
+    }
+}
+
+static void sco_push_runner(struct sco *co) {
+    sco_use_level(co);
+    struct sco_runq *rq = &sco_runqs[co->prio];
+    sco_queue_push(&rq->runners, co);
+    rq->nrunners++;
+    sco_nrunners++;
+}
+
+static void sco_push_yielder(struct sco *co) {
+    sco_stat_queued(co);
+    sco_use_level(co);
+    struct sco_runq *rq = &sco_runqs[co->prio];
+    sco_queue_push(&rq->yielders, co);
+    rq->nyielders++;
+    sco_nyielders++;
+}
+
+// Convert the yielders of a level to runners.
+static void sco_runq_promote(struct sco_sched *S, struct sco_runq *rq) {
+    if (rq->nyielders == 0) {
+        return;
+    }
+    sco_queue_splice(&rq->runners, &rq->yielders);
+    rq->nrunners += rq->nyielders;
+    S->nrunners += rq->nyielders;
+    S->nyielders -= rq->nyielders;
+    rq->nyielders = 0;
+}
+
+// Take the next runner. There must be at least one runner in some level.
+// A level whose runners are all done has its yielders promoted right away
+// while lower levels are still in their round, thus a higher priority
+// coroutine that was resumed or yielded does not wait for the lower ones.
+static struct sco *sco_runq_pop(struct sco_sched *S) {
+    if (S->rec_mode == SCO_REPLAYING) {
+        struct sco *co = sco_replay_take();
+        if (co) {
+            sco_stat_dequeued(co);
+            return co;
+        }
+    }
+    if (!S->multilevel) {
+        struct sco_runq *rq = &S->runqs[SCO_LEVEL_NORMAL];
+        if (rq->nrunners == 0) {
+            sco_runq_promote(S, rq);
+        }
+        rq->nrunners--;
+        S->nrunners--;
+        struct sco *co = sco_queue_pop(&rq->runners);
+        sco_stat_dequeued(co);
+        return co;
+    }
+    int pick = 0;
+    for (int i = SCO_NPRIOS-1; i >= 0; i--) {
+        struct sco_runq *rq = &S->runqs[i];
+        if (rq->nrunners == 0) {
+            sco_runq_promote(S, rq);
+        }
+        if (rq->nrunners > 0) {
+            pick = i;
+            break;
+        }
+    }
+    for (int i = 0; i < pick; i++) {
+        if (S->runqs[i].nrunners > 0 && 
+            S->runqs[i].skipped >= SCO_PRIO_STARVE)
+        {
+            // This lower level has waited long enough.
+            pick = i;
+            break;
+        }
+    }
+    for (int i = 0; i < pick; i++) {
+        if (S->runqs[i].nrunners > 0) {
+            S->runqs[i].skipped++;
+        }
+    }
+    struct sco_runq *rq = &S->runqs[pick];
+    rq->skipped = 0;
+    rq->nrunners--;
+    S->nrunners--;
+    struct sco *co = sco_queue_pop(&rq->runners);
+    sco_stat_dequeued(co);
+    return co;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sco_deque - A bounded Chase-Lev work-stealing deque. The owning thread
+// pushes to the bottom and every thread, including the owner, takes from the
+// top, which keeps the scheduling order FIFO.
+// https://fzn.fr/readings/ppopp13.pdf
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_MAXWORKERS
+#define SCO_MAXWORKERS 64
+#endif
+
+#ifndef SCO_DEQUESIZE
+#define SCO_DEQUESIZE 1024 // must be a power of two
+#endif
+
+#ifndef SCO_NUMA_IMBALANCE
+#define SCO_NUMA_IMBALANCE 8 // backlog needed to steal from another node
+#endif
+
+#ifndef SCO_STEALMAX
+#define SCO_STEALMAX 32
+#endif
+
+struct sco_deque {
+    atomic_int_fast64_t top;
+    char pad0[64-sizeof(atomic_int_fast64_t)];
+    atomic_int_fast64_t bottom;
+    char pad1[64-sizeof(atomic_int_fast64_t)];
+    _Atomic(struct sco*) buf[SCO_DEQUESIZE];
+};
+
+static bool sco_deque_push(struct sco_deque *dq, struct sco *co) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if (b-t >= SCO_DEQUESIZE) {
+        return false;
+    }
+    atomic_store_explicit(&dq->buf[b&(SCO_DEQUESIZE-1)], co,
+        memory_order_relaxed);
+    atomic_store_explicit(&dq->bottom, b+1, memory_order_release);
+    return true;
+}
+
+// Only the owner pushes, so a deque that it sees as not full stays that way
+// until its next push.
+static bool sco_deque_full(struct sco_deque *dq) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    return b-t >= SCO_DEQUESIZE;
+}
+
+static struct sco *sco_deque_steal(struct sco_deque *dq) {
+    while (1) {
+        int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+        if (t >= b) {
+            return NULL;
+        }
+        struct sco *co = atomic_load_explicit(&dq->buf[t&(SCO_DEQUESIZE-1)],
+            memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&dq->top, &t, t+1,
+            memory_order_seq_cst, memory_order_relaxed))
+        {
+            return co;
+        }
+        // Lost the race to another thief. Try again.
+    }
+}
+
+static size_t sco_deque_count(struct sco_deque *dq) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    return b > t ? (size_t)(b-t) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Worker pool. Each joined thread owns one deque. Yielded coroutines are
+// published to the deque only after the thread has switched away from them,
+// that way a thief can never resume a coroutine whose context is not yet
+// saved.
+////////////////////////////////////////////////////////////////////////////////
+
+static struct sco_deque sco_deques[SCO_MAXWORKERS];
+static atomic_bool sco_workers[SCO_MAXWORKERS];
+static atomic_int_fast64_t sco_pool_live = 0;
+static __thread int sco_worker = -1;
+
+// The NUMA node of each worker, and of the calling thread, or -1 if the
+// thread's node is not known yet.
+static atomic_int sco_worker_nodes[SCO_MAXWORKERS];
+static __thread int sco_node_id = -1;
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static int sco_node_detect(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
+// Returns the number of coroutines in the current thread's deque.
+static size_t sco_pool_count(void) {
+    return sco_worker < 0 ? 0 : sco_deque_count(&sco_deques[sco_worker]);
+}
+
+static void sco_pool_flush0(void) {
+    // Only the normal priority level is shared with the pool.
+    struct sco_runq *rq = &sco_runqs[sco_prio_index(SCO_PRIO_NORMAL)];
+    struct sco_deque *dq = &sco_deques[sco_worker];
+    while (rq->nyielders > 0 && !sco_deque_full(dq)) {
+        // Unlink the coroutine before pushing, because another thread may
+        // steal it, and even run it to completion, right after the push.
+        // The remaining yielders stay local when the deque is full.
+        struct sco *co = sco_queue_pop(&rq->yielders);
+        rq->nyielders--;
+        sco_nyielders--;
+        sco_deque_push(dq, co);
+    }
+}
+
+// Move the yielders into the current thread's deque, making them available
+// to other threads. Must only be called right after a context switch.
+// Threads that are not in the pool only pay for the branch.
+static void sco_pool_flush(void) {
+    if (sco_unlikely(sco_worker >= 0) && sco_nyielders > 0) {
+        sco_pool_flush0();
+    }
+}
+
+// Move the coroutines from the current thread's deque into the runners.
+static void sco_pool_take(void) {
+    struct sco_deque *dq = &sco_deques[sco_worker];
+    struct sco *co;
+    while ((co = sco_deque_steal(dq))) {
+        co->prev = co;
+        co->next = co;
+        sco_push_runner(co);
+    }
+}
+
+// Steal up to half of the coroutines in the worker's deque and add them to
+// the runners. Returns the number of coroutines stolen.
+static size_t sco_pool_steal_from(int j, size_t min) {
+    struct sco_deque *dq = &sco_deques[j];
+    size_t count = sco_deque_count(dq);
+    if (count < min) {
+        return 0;
+    }
+    size_t n = (count+1)/2;
+    n = n < SCO_STEALMAX ? n : SCO_STEALMAX;
+    size_t nstolen = 0;
+    for (size_t k = 0; k < n; k++) {
+        struct sco *co = sco_deque_steal(dq);
+        if (!co) {
+            break;
+        }
+        co->prev = co;
+        co->next = co;
+        sco_push_runner(co);
+        nstolen++;
+    }
+    return nstolen;
+}
+
+// Steal coroutines from the other threads in the pool and add them to the
+// runners. Threads on the same NUMA node are tried first, and the threads
+// on other nodes only when they have a backlog of at least 
+// SCO_NUMA_IMBALANCE coroutines, because a stolen coroutine keeps using the
+// stack memory of its old node. Returns the number of coroutines stolen.
+static size_t sco_pool_steal(void) {
+    int node = sco_node_id < 0 ? 0 : sco_node_id;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 1; i < SCO_MAXWORKERS; i++) {
+            int j = (sco_worker+i) % SCO_MAXWORKERS;
+            if (!atomic_load_explicit(&sco_workers[j], memory_order_acquire)) {
+                continue;
+            }
+            bool local = atomic_load_explicit(&sco_worker_nodes[j], 
+                memory_order_relaxed) == node;
+            if (local != (pass == 0)) {
+                continue;
+            }
+            size_t nstolen = sco_pool_steal_from(j, 
+                local ? 1 : SCO_NUMA_IMBALANCE);
+            if (nstolen > 0) {
+                return nstolen;
+            }
+        }
+    }
+    return 0;
+}
+
+// Refill the runners of a pooled thread that has run out of them, taking
+// from its own deque first and stealing from the other threads when there is
+// nothing left. Returns false if the thread should return to main instead.
+static bool sco_pool_refill(bool resumed_from_main) {
+    size_t nyielders = sco_nyielders + sco_pool_count();
+    if (sco_exit_to_main_requested || (nyielders > 0 && 
+        !resumed_from_main && sco_npaused > 0)) {
+        return false;
+    }
+    if (nyielders == 0) {
+        // Nothing left on this thread. Try stealing from the pool.
+        return sco_pool_steal() > 0;
+    }
+    // Pooled yielders come before the local yielders.
+    sco_pool_take();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stack pool. Stacks for sco_start_pooled() are cached per thread in power of
+// two size classes, starting at SCO_MINSTACKSIZE. On systems with mmap each
+// stack is mapped with a guard page at the bottom, and the memory for stacks
+// that are cached above the high-water mark is returned to the OS.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_STACK_NCLASSES
+#define SCO_STACK_NCLASSES 8
+#endif
+
+#ifndef SCO_STACK_HIGHWATER
+#define SCO_STACK_HIGHWATER 64
+#endif
+
+// Define SCO_STACK_LAZY to map the pooled stacks without reserving swap
+// space, and to return all but the hottest SCO_STACK_HOTSIZE bytes of each 
+// stack to the OS when it goes back to the pool. Only the pages that a
+// coroutine actually touches are ever committed, at the cost of one madvise
+// call per release.
+#ifndef SCO_STACK_HOTSIZE
+#define SCO_STACK_HOTSIZE 16384
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && \
+    (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifdef MAP_ANONYMOUS
+#define SCO_MMAP
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Prefer the thread's NUMA node for the stack memory, when the node is
+// known. Without a node the memory follows the kernel's first-touch policy,
+// which is the node of the thread that starts the coroutine.
+#ifdef SCO_MMAP
+static void sco_stack_bind(void *mem, size_t mem_size) {
+#if defined(__linux__) && defined(SYS_mbind) && !defined(SCO_NONUMA)
+    unsigned long mask = 0;
+    int nbits = (int)sizeof(mask)*8;
+    if (sco_node_id >= 0 && sco_node_id < nbits) {
+        mask = 1UL<<sco_node_id;
+        // The kernel only reads maxnode-1 bits of the mask.
+        syscall(SYS_mbind, mem, mem_size, 1 /* MPOL_PREFERRED */, &mask, 
+            (unsigned long)nbits+1, 0);
+    }
+#else
+    (void)mem, (void)mem_size;
+#endif
+}
+#endif
+
+// The header lives at the very top of the stack memory, above the part that
+// is given to the coroutine. An extra page is mapped for it, so the usable
+// part of every stack is at least as large as its size class.
+struct sco_stack {
+    struct sco_stack *next;
+    void *mem;           // start of the memory, including the guard page
+    size_t mem_size;     // size of the memory, including the guard page
+    int sclass;          // size class, or -1 for an uncached stack
+    void (*cleanup)(void *stack, size_t stack_size, void *udata);
+};
+
+// Keep the top of the usable stack aligned to a cache line.
+#define SCO_STACK_HDRSIZE ((sizeof(struct sco_stack)+63)&~(size_t)63)
+
+static __thread struct sco_stack *sco_stacks[SCO_STACK_NCLASSES];
+static __thread size_t sco_nstacks[SCO_STACK_NCLASSES];
+
+static size_t sco_pagesize(void) {
+#ifdef SCO_MMAP
+    static atomic_size_t pagesize = 0;
+    size_t size = atomic_load_explicit(&pagesize, memory_order_relaxed);
+    if (!size) {
+        size = (size_t)sysconf(_SC_PAGESIZE);
+        atomic_store_explicit(&pagesize, size, memory_order_relaxed);
+    }
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+static void sco_stack_oom(void) {
+    fprintf(stderr, "out of memory\n");
+    abort();
+}
+
+// Returns the size class for a stack size, or -1 if it's too large to cache.
+static int sco_stack_class(size_t stack_size) {
+    int sclass = 0;
+    while (sclass < SCO_STACK_NCLASSES &&
+        ((size_t)SCO_MINSTACKSIZE<<sclass) < stack_size)
+    {
+        sclass++;
+    }
+    return sclass < SCO_STACK_NCLASSES ? sclass : -1;
+}
+
+static struct sco_stack *sco_stack_alloc(size_t stack_size) {
+    stack_size = stack_size < SCO_MINSTACKSIZE ? SCO_MINSTACKSIZE : stack_size;
+    int sclass = sco_stack_class(stack_size);
+    if (sclass >= 0) {
+        if (sco_stacks[sclass]) {
+            struct sco_stack *stack = sco_stacks[sclass];
+            sco_stacks[sclass] = stack->next;
+            sco_nstacks[sclass]--;
+            return stack;
+        }
+        stack_size = (size_t)SCO_MINSTACKSIZE<<sclass;
+    }
+    size_t pagesize = sco_pagesize();
+    stack_size = (stack_size+pagesize-1)&~(pagesize-1);
+#ifdef SCO_MMAP
+#ifdef SCO_STACK_NOGUARD
+    size_t guard = 0;
+#else
+    size_t guard = pagesize;
+#endif
+    size_t mem_size = stack_size+guard+pagesize;
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+#if defined(SCO_STACK_LAZY) && defined(MAP_NORESERVE)
+    flags |= MAP_NORESERVE;
+#endif
+    void *mem = mmap(0, mem_size, PROT_READ|PROT_WRITE, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+        sco_stack_oom();
+    }
+    if (guard && mprotect(mem, guard, PROT_NONE) != 0) {
+        sco_stack_oom();
+    }
+    sco_stack_bind(mem, mem_size);
+#else
+    size_t mem_size = stack_size+SCO_STACK_HDRSIZE;
+    void *mem = malloc(mem_size);
+    if (!mem) {
+        sco_stack_oom();
+    }
+#endif
+    struct sco_stack *stack = (void*)((char*)mem+mem_size-SCO_STACK_HDRSIZE);
+    stack->next = NULL;
+    stack->mem = mem;
+    stack->mem_size = mem_size;
+    stack->sclass = sclass;
+    stack->cleanup = NULL;
+    return stack;
+}
+
+static void sco_stack_unmap(struct sco_stack *stack) {
+#ifdef SCO_MMAP
+    munmap(stack->mem, stack->mem_size);
+#else
+    free(stack->mem);
+#endif
+}
+
+static void sco_stack_release(struct sco_stack *stack) {
+    if (stack->sclass < 0) {
+        sco_stack_unmap(stack);
+        return;
+    }
+#ifdef SCO_MMAP
+    size_t pagesize = sco_pagesize();
+    char *base = (char*)stack->mem;
+    char *top = (char*)(((uintptr_t)stack)&~(pagesize-1));
+    if (sco_nstacks[stack->sclass] >= SCO_STACK_HIGHWATER) {
+        // Return everything but the page holding the header.
+        if (top > base) {
+            madvise(base, (size_t)(top-base), MADV_DONTNEED);
+        }
+    }
+#ifdef SCO_STACK_LAZY
+    else {
+        // Return everything but the hot part at the top.
+        top -= SCO_STACK_HOTSIZE&~(pagesize-1);
+        if (top > base) {
+            madvise(base, (size_t)(top-base), MADV_DONTNEED);
+        }
+    }
+#endif
+#endif
+    stack->next = sco_stacks[stack->sclass];
+    sco_stacks[stack->sclass] = stack;
+    sco_nstacks[stack->sclass]++;
+}
+
+static void *sco_stack_base(struct sco_stack *stack) {
+#if defined(SCO_MMAP) && !defined(SCO_STACK_NOGUARD)
+    return (char*)stack->mem+sco_pagesize();
+#else
+    return stack->mem;
+#endif
+}
+
+static void sco_stack_cleanup(void *stack, size_t stack_size, void *udata) {
+    struct sco_stack *hdr = (void*)((char*)stack+stack_size);
+    if (hdr->cleanup) {
+        hdr->cleanup(stack, stack_size, udata);
+    }
+    sco_stack_release(hdr);
+}
+
+// Fills the resident and highwater fields for the provided stack memory by
+// asking the OS which of its pages are backed by physical memory.
+static bool sco_stack_usage(struct sco_stack_info *info) {
+#if defined(SCO_MMAP) && !defined(SCO_NOMINCORE)
+    size_t pagesize = sco_pagesize();
+    uintptr_t base = ((uintptr_t)info->stack+pagesize-1)&~(pagesize-1);
+    uintptr_t top = ((uintptr_t)info->stack+info->stack_size+pagesize-1)&
+        ~(pagesize-1);
+    info->resident = 0;
+    info->highwater = 0;
+#ifdef __linux__
+    unsigned char vec[256];
+#else
+    char vec[256];
+#endif
+    bool deepest = false;
+    for (uintptr_t addr = base; addr < top; ) {
+        size_t npages = (top-addr)/pagesize;
+        npages = npages < sizeof(vec) ? npages : sizeof(vec);
+        if (mincore((void*)addr, npages*pagesize, vec) != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < npages; i++) {
+            if (vec[i]&1) {
+                if (!deepest) {
+                    // The stack grows down, thus the lowest resident page
+                    // marks the deepest point it has reached.
+                    info->highwater = 
+                        (uintptr_t)info->stack+info->stack_size-
+                        (addr+i*pagesize);
+                    deepest = true;
+                }
+                info->resident += pagesize;
+            }
+        }
+        addr += npages*pagesize;
+    }
+    if (info->resident > info->stack_size) {
+        // The top page is shared with memory just above the stack.
+        info->resident = info->stack_size;
+    }
+    return true;
+#else
+    (void)info;
+    return false;
+#endif
+}
+
+// A spawned coroutine has its struct sco at the top of its stack, rather
+// than in sco_entry's frame, so that it can be queued before its context is
+// created. The context is made on the first switch into it.
+struct sco_spawn {
+    struct sco co;
+    void (*entry)(void *udata);
+    void (*cleanup)(void *stack, size_t stack_size, void *udata);
+    size_t stack_size;   // full size of the user's stack
+};
+
+static void sco_spawn_start(struct sco *co, bool final);
+
+static void sco_return_to_main(bool final) {
+    if (sco_cur) {
+        // The runloop finding nothing to run is not a switch.
+        sco_probe2(switch, sco_cur->id, 0);
+    }
+    sco_cur = NULL;
+    sco_exit_to_main_requested = false;
+    llco_switch(0, final);
+}
+
+static size_t sco_inbox_drain(bool replay);
+
+static void sco_switch(bool resumed_from_main, bool final) {
+    struct sco_sched *S = sco_S;
+#ifdef SCO_USDT
+    int64_t from_id = S->cur ? S->cur->id : 0;
+#endif
+    if (S->cur) {
+        sco_slice_end(S->cur);
+    }
+    if (S->nrunners == 0) {
+        // No more runners.
+        if (S->inbox) {
+            sco_inbox_drain(true);
+        }
+        if (sco_unlikely(sco_worker >= 0)) {
+            if (!sco_pool_refill(resumed_from_main)) {
+                sco_return_to_main(final);
+                return;
+            }
+        } else if (S->exit_to_main_requested || S->nyielders == 0 ||
+            (!resumed_from_main && S->npaused > 0))
+        {
+            sco_return_to_main(final);
+            return;
+        }
+        // Convert the yielders to runners
+        if (!S->multilevel) {
+            sco_runq_promote(S, &S->runqs[SCO_LEVEL_NORMAL]);
+        } else {
+            for (int i = 0; i < SCO_NPRIOS; i++) {
+                sco_runq_promote(S, &S->runqs[i]);
+            }
+        }
+    }
+    struct sco *co = sco_runq_pop(S);
+    S->cur = co;
+    sco_stat(switches);
+    sco_probe2(switch, from_id, co->id);
+    sco_slice_begin();
+    if (co->llco) {
+        llco_switch(co->llco, final);
+    } else {
+        sco_spawn_start(co, final);
+    }
+    sco_pool_flush();
+}
+
+static void sco_group_leave(struct sco *co);
+
+// Join a group for a new coroutine, returning the group to store in it.
+// Coroutines started on a pool thread don't join, because they can be stolen
+// by another thread while the group is not thread-safe.
+static struct sco_group *sco_group_join(struct sco_group *group) {
+    if (!group || sco_worker >= 0) {
+        return NULL;
+    }
+    group->count++;
+    return group;
+}
+
+// Bookkeeping for a coroutine that is done, whether it returned from its
+// entry, called sco_exit(), or was a worker task that parked. A parked
+// worker that is finished later was already torn down when it parked.
+static void sco_teardown(struct sco *co) {
+    if (co->done) {
+        return;
+    }
+    co->done = true;
+    if (co->pooled) {
+        atomic_fetch_sub(&sco_pool_live, 1);
+        co->pooled = false;
+    }
+    sco_group_leave(co);
+    sco_stat(exits);
+    sco_probe1(exit, co->id);
+}
+
+// The coroutine has returned from its entry. Switch to the next coroutine.
+static void sco_finish(struct sco *co) {
+    sco_teardown(co);
+    sco_switch(false, true);
+}
+
+static void sco_entry(void *udata) {
+    // Initialize a new coroutine on the user's stack.
+    struct sco scostk = { 0 };
+    struct sco *co = &scostk;
+    co->llco = llco_current();
+    co->id = atomic_fetch_add(&sco_next_id, 1) + 1;
+    co->udata = udata;
+    co->stack = sco_user_stack;
+    co->stack_size = sco_user_stack_size;
+    co->prev = co;
+    co->next = co;
+    co->prio = sco_prio_index(sco_user_priority);
+    co->group = sco_user_group;
+    co->pooled = sco_worker >= 0;
+    if (co->pooled) {
+        atomic_fetch_add(&sco_pool_live, 1);
+    }
+    sco_pool_flush();
+    sco_stat(starts);
+    sco_probe1(start, co->id);
+    if (sco_cur) {
+        // Reschedule the coroutine that started this one immediately after
+        // all running coroutines, but before any yielding coroutines, and
+        // continue running the started coroutine.
+        sco_slice_end(sco_cur);
+        sco_stat_queued(sco_cur);
+        sco_push_runner(sco_cur);
+    }
+    sco_cur = co;
+    sco_slice_begin();
+    if (sco_user_entry) {
+        sco_user_entry(udata);
+    }
+    sco_finish(co);
+}
+
+static void sco_spawn_entry(void *udata) {
+    // The coroutine was made current by sco_switch.
+    struct sco_spawn *sp = udata;
+    sp->co.llco = llco_current();
+    sco_pool_flush();
+    sco_stat(starts);
+    sco_probe1(start, sp->co.id);
+    if (sp->entry) {
+        sp->entry(sp->co.udata);
+    }
+    sco_finish(&sp->co);
+}
+
+static void sco_spawn_cleanup(void *stack, size_t stack_size, void *udata) {
+    (void)stack_size;
+    struct sco_spawn *sp = udata;
+    if (sp->cleanup) {
+        sp->cleanup(stack, sp->stack_size, sp->co.udata);
+    }
+}
+
+static void sco_spawn_start(struct sco *co, bool final) {
+    struct sco_spawn *sp = (struct sco_spawn*)co;
+    struct llco_desc llco_desc = {
+        .entry = sco_spawn_entry,
+        .cleanup = sco_spawn_cleanup,
+        .stack = co->stack,
+        .stack_size = co->stack_size,
+        .udata = sp,
+    };
+    llco_start(&llco_desc, final);
+}
+
+SCO_EXTERN
+void sco_exit(void) {
+    if (sco_cur) {
+        sco_teardown(sco_cur);
+        sco_exit_to_main_requested = true;
+        sco_switch(false, true);
+    }
+}
+
+SCO_EXTERN
+void sco_start(struct sco_desc *desc) {
+    sco_init();
+    struct llco_desc llco_desc = {
+        .entry = sco_entry,
+        .cleanup = desc->cleanup,
+        .stack = desc->stack,
+        .stack_size = desc->stack_size,
+        .udata = desc->udata,
+    };
+    sco_user_entry = desc->entry;
+    sco_user_stack = desc->stack;
+    sco_user_stack_size = desc->stack_size;
+    sco_user_priority = desc->priority;
+    sco_user_group = sco_group_join(desc->group);
+    llco_start(&llco_desc, false);
+    sco_pool_flush();
+}
+
+SCO_EXTERN
+int64_t sco_spawn(struct sco_desc *desc) {
+    sco_init();
+    uintptr_t top = (uintptr_t)desc->stack+desc->stack_size;
+    struct sco_spawn *sp = (void*)((top-sizeof(struct sco_spawn))&~63);
+    *sp = (struct sco_spawn){ 0 };
+    sp->entry = desc->entry;
+    sp->cleanup = desc->cleanup;
+    sp->stack_size = desc->stack_size;
+    struct sco *co = &sp->co;
+    co->id = atomic_fetch_add(&sco_next_id, 1) + 1;
+    co->udata = desc->udata;
+    co->stack = desc->stack;
+    co->stack_size = (size_t)((char*)sp-(char*)desc->stack);
+    co->prio = sco_prio_index(desc->priority);
+    co->group = sco_group_join(desc->group);
+    co->pooled = sco_worker >= 0;
+    if (co->pooled) {
+        atomic_fetch_add(&sco_pool_live, 1);
+    }
+    co->prev = co;
+    co->next = co;
+    sco_push_yielder(co);
+    return co->id;
+}
+
+SCO_EXTERN
+void sco_spawn_many(struct sco_desc *descs, size_t n, int64_t *ids) {
+    for (size_t i = 0; i < n; i++) {
+        int64_t id = sco_spawn(&descs[i]);
+        if (ids) {
+            ids[i] = id;
+        }
+    }
+}
+
+SCO_EXTERN
+void sco_start_pooled(struct sco_desc *desc) {
+    struct sco_stack *stack = sco_stack_alloc(desc->stack_size);
+    stack->cleanup = desc->cleanup;
+    void *base = sco_stack_base(stack);
+    struct sco_desc pdesc = *desc;
+    pdesc.stack = base;
+    pdesc.stack_size = (size_t)((char*)stack-(char*)base);
+    pdesc.cleanup = sco_stack_cleanup;
+    sco_start(&pdesc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Workers. A worker is a coroutine on a pooled stack that, instead of 
+// finishing, parks itself when its entry returns. The next sco_start_worker()
+// call for the same size class switches straight into the parked worker with
+// the new entry, skipping the context creation and the stack cleanup.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_WORKER_MAXIDLE
+#define SCO_WORKER_MAXIDLE 64 // parked workers per size class
+#endif
+
+static __thread struct sco *sco_idle[SCO_STACK_NCLASSES];
+static __thread size_t sco_nidle[SCO_STACK_NCLASSES];
+static __thread void (*sco_task_entry)(void *udata);
+
+static int sco_worker_class(struct sco *co) {
+    struct sco_stack *hdr = (void*)((char*)co->stack+co->stack_size);
+    return hdr->sclass;
+}
+
+static void sco_worker_main(void *udata) {
+    struct sco *co = sco_cur;
+    void (*entry)(void *udata) = sco_task_entry;
+    while (entry) {
+        entry(udata);
+        int sclass = sco_worker_class(co);
+        if (sclass < 0 || sco_nidle[sclass] >= SCO_WORKER_MAXIDLE) {
+            break;
+        }
+        // Park the worker.
+        sco_teardown(co);
+        co->next = sco_idle[sclass];
+        sco_idle[sclass] = co;
+        sco_nidle[sclass]++;
+        sco_switch(false, false);
+        // Woken by sco_worker_wake() with a new entry, or NULL to finish.
+        entry = sco_task_entry;
+        udata = co->udata;
+        co->done = !entry;
+        co->pooled = entry && sco_worker >= 0;
+        if (co->pooled) {
+            atomic_fetch_add(&sco_pool_live, 1);
+        }
+    }
+}
+
+// Switch into a parked worker, rescheduling the current coroutine the same
+// way that sco_start() does.
+static void sco_worker_wake(struct sco *co, void (*entry)(void *udata)) {
+    co->prev = co;
+    co->next = co;
+    sco_task_entry = entry;
+    if (sco_cur) {
+        sco_slice_end(sco_cur);
+        sco_stat_queued(sco_cur);
+        sco_push_runner(sco_cur);
+    }
+    sco_cur = co;
+    sco_slice_begin();
+    llco_switch(co->llco, false);
+    sco_pool_flush();
+}
+
+SCO_EXTERN
+void sco_start_worker(struct sco_desc *desc) {
+    sco_init();
+    size_t stack_size = desc->stack_size < SCO_MINSTACKSIZE ? 
+        SCO_MINSTACKSIZE : desc->stack_size;
+    int sclass = sco_stack_class(stack_size);
+    if (sclass >= 0 && sco_idle[sclass]) {
+        struct sco *co = sco_idle[sclass];
+        sco_idle[sclass] = co->next;
+        sco_nidle[sclass]--;
+        co->id = atomic_fetch_add(&sco_next_id, 1) + 1;
+        co->udata = desc->udata;
+        co->prio = sco_prio_index(desc->priority);
+        co->group = sco_group_join(desc->group);
+        sco_stat(starts);
+        sco_probe1(start, co->id);
+        sco_worker_wake(co, desc->entry);
+        return;
+    }
+    struct sco_desc wdesc = *desc;
+    wdesc.entry = sco_worker_main;
+    wdesc.cleanup = NULL;
+    sco_task_entry = desc->entry;
+    sco_start_pooled(&wdesc);
+}
+
+// Finish all of the parked workers, returning their stacks to the pool.
+static void sco_worker_trim(void) {
+    for (int i = 0; i < SCO_STACK_NCLASSES; i++) {
+        while (sco_idle[i]) {
+            struct sco *co = sco_idle[i];
+            sco_idle[i] = co->next;
+            sco_nidle[i]--;
+            sco_worker_wake(co, NULL);
+        }
+    }
+}
+
+SCO_EXTERN
+size_t sco_info_workers(void) {
+    size_t nidle = 0;
+    for (int i = 0; i < SCO_STACK_NCLASSES; i++) {
+        nidle += sco_nidle[i];
+    }
+    return nidle;
+}
+
+SCO_EXTERN
+bool sco_stack_info(struct sco_stack_info *info) {
+    if (!sco_cur || !sco_cur->stack) {
+        return false;
+    }
+    info->stack = sco_cur->stack;
+    info->stack_size = sco_cur->stack_size;
+    return sco_stack_usage(info);
+}
+
+SCO_EXTERN
+void sco_stack_trim(void) {
+    sco_worker_trim();
+    for (int i = 0; i < SCO_STACK_NCLASSES; i++) {
+        while (sco_stacks[i]) {
+            struct sco_stack *stack = sco_stacks[i];
+            sco_stacks[i] = stack->next;
+            sco_stack_unmap(stack);
+        }
+        sco_nstacks[i] = 0;
+    }
+}
+
+SCO_EXTERN
+size_t sco_info_stacks(void) {
+    size_t nstacks = 0;
+    for (int i = 0; i < SCO_STACK_NCLASSES; i++) {
+        nstacks += sco_nstacks[i];
+    }
+    return nstacks;
+}
+
+SCO_EXTERN
+int64_t sco_id(void) {
     return sco_cur ? sco_cur->id : 0;
 }
 
-SCO_EXTERN
-void sco_yield(void) {
-    if (sco_cur) {
-        sco_list_push_back(&sco_yielders, sco_cur);
-        sco_nyielders++;
-        sco_switch(false, false);
+SCO_EXTERN
+void sco_yield(void) {
+    if (sco_cur) {
+        sco_stat(yields);
+        sco_push_yielder(sco_cur);
+        sco_switch(false, false);
+    }
+}
+
+SCO_EXTERN
+void sco_pause(void) {
+    if (sco_cur) {
+        if (sco_cur->handled) {
+            sco_cur->handled = false;
+            sco_cur->hpaused = true;
+            sco_list_push_back(&sco_hpaused, sco_cur);
+        } else {
+            sco_map_insert(&sco_paused, sco_cur);
+        }
+        sco_npaused++;
+        sco_stat(pauses);
+        sco_probe1(pause, sco_cur->id);
+        sco_switch(false, false);
+    }
+}
+
+SCO_EXTERN
+struct sco_handle sco_pause_handle(void) {
+    if (!sco_cur) {
+        return (struct sco_handle){ 0 };
+    }
+    sco_cur->gen++;
+    sco_cur->handled = true;
+    return (struct sco_handle){ .co = sco_cur, .gen = sco_cur->gen };
+}
+
+// Schedule the coroutine belonging to the handle, without yielding.
+static bool sco_resume_handle0(struct sco_handle handle) {
+    struct sco *co = handle.co;
+    if (!co || !co->hpaused || co->gen != handle.gen) {
+        return false;
+    }
+    sco_remove_from_list(co);
+    co->hpaused = false;
+    co->gen++;
+    sco_npaused--;
+    sco_stat(resumes);
+    sco_probe1(resume, co->id);
+    sco_push_yielder(co);
+    return true;
+}
+
+SCO_EXTERN
+bool sco_resume_handle(struct sco_handle handle) {
+    if (!sco_resume_handle0(handle)) {
+        return false;
+    }
+    sco_yield();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Synchronization. Waiting coroutines are linked into a FIFO through their
+// wnext field and count as paused, so waking one is a couple of pointer moves
+// without any lookup in the paused map. They are also kept in the thread's
+// blocked list for sco_dump().
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+// Pause the current coroutine at the back of the wait queue.
+// Returns false if not called from a coroutine, or if called from a pool
+// thread, where another thread could steal the waiters once they are woken.
+static bool sco_waitq_wait0(struct sco_waitq *wq) {
+    if (!sco_cur || sco_worker >= 0) {
+        return false;
+    }
+    struct sco *co = sco_cur;
+    co->wnext = NULL;
+    if (wq->tail) {
+        ((struct sco*)wq->tail)->wnext = co;
+    } else {
+        wq->head = co;
+    }
+    wq->tail = co;
+    wq->count++;
+    sco_list_push_back(&sco_blocked, co);
+    sco_npaused++;
+    sco_stat(pauses);
+    sco_probe1(pause, co->id);
+    sco_switch(false, false);
+    return true;
+}
+
+// Schedule the coroutine at the front of the wait queue.
+static bool sco_waitq_notify0(struct sco_waitq *wq) {
+    struct sco *co = wq->head;
+    if (!co) {
+        return false;
+    }
+    wq->head = co->wnext;
+    if (!wq->head) {
+        wq->tail = NULL;
+    }
+    wq->count--;
+    sco_npaused--;
+    sco_stat(resumes);
+    sco_probe1(resume, co->id);
+    sco_remove_from_list(co);
+    sco_push_yielder(co);
+    return true;
+}
+
+SCO_EXTERN
+bool sco_waitq_wait(struct sco_waitq *wq) {
+    return sco_waitq_wait0(wq);
+}
+
+SCO_EXTERN
+bool sco_waitq_notify(struct sco_waitq *wq) {
+    return sco_waitq_notify0(wq);
+}
+
+SCO_EXTERN
+size_t sco_waitq_notify_all(struct sco_waitq *wq) {
+    size_t count = 0;
+    while (sco_waitq_notify0(wq)) {
+        count++;
+    }
+    return count;
+}
+
+SCO_EXTERN
+bool sco_mutex_trylock(struct sco_mutex *mu) {
+    if (mu->locked) {
+        return false;
+    }
+    mu->locked = true;
+    return true;
+}
+
+SCO_EXTERN
+bool sco_mutex_lock(struct sco_mutex *mu) {
+    if (mu->locked) {
+        // The unlocking coroutine hands the mutex over to this one.
+        return sco_waitq_wait0(&mu->waiters);
+    }
+    mu->locked = true;
+    return true;
+}
+
+SCO_EXTERN
+void sco_mutex_unlock(struct sco_mutex *mu) {
+    if (!sco_waitq_notify0(&mu->waiters)) {
+        mu->locked = false;
+    }
+}
+
+SCO_EXTERN
+bool sco_sem_trywait(struct sco_sem *sem) {
+    if (sem->count == 0) {
+        return false;
+    }
+    sem->count--;
+    return true;
+}
+
+SCO_EXTERN
+bool sco_sem_wait(struct sco_sem *sem) {
+    if (sem->count == 0) {
+        // The posting coroutine hands its unit over to this one.
+        return sco_waitq_wait0(&sem->waiters);
+    }
+    sem->count--;
+    return true;
+}
+
+SCO_EXTERN
+void sco_sem_post(struct sco_sem *sem) {
+    if (!sco_waitq_notify0(&sem->waiters)) {
+        sem->count++;
+    }
+}
+
+// Leave the coroutine's group, if any, when it finishes.
+static void sco_group_leave(struct sco *co) {
+    struct sco_group *group = co->group;
+    if (!group) {
+        return;
+    }
+    co->group = NULL;
+    if (--group->count == 0) {
+        while (sco_waitq_notify0(&group->waiters)) { }
+    }
+}
+
+SCO_EXTERN
+bool sco_group_wait(struct sco_group *group) {
+    if (sco_worker >= 0) {
+        return false;
+    }
+    if (group->count == 0) {
+        return true;
+    }
+    return sco_waitq_wait0(&group->waiters);
+}
+
+SCO_EXTERN
+void sco_chan_init(struct sco_chan *chan, void *buf, size_t elsize,
+    size_t cap)
+{
+    *chan = (struct sco_chan){ .buf = buf, .elsize = elsize, .cap = cap };
+}
+
+SCO_EXTERN
+bool sco_chan_send(struct sco_chan *chan, const void *elem) {
+    while (!chan->closed && chan->len == chan->cap) {
+        if (!sco_waitq_wait0(&chan->senders)) {
+            return false;
+        }
+    }
+    if (chan->closed) {
+        return false;
+    }
+    size_t tail = (chan->head+chan->len)%chan->cap;
+    memcpy((char*)chan->buf+tail*chan->elsize, elem, chan->elsize);
+    chan->len++;
+    sco_waitq_notify0(&chan->receivers);
+    return true;
+}
+
+SCO_EXTERN
+bool sco_chan_recv(struct sco_chan *chan, void *elem) {
+    while (!chan->closed && chan->len == 0) {
+        if (!sco_waitq_wait0(&chan->receivers)) {
+            return false;
+        }
+    }
+    if (chan->len == 0) {
+        // Closed and drained.
+        return false;
+    }
+    memcpy(elem, (char*)chan->buf+chan->head*chan->elsize, chan->elsize);
+    chan->head = (chan->head+1)%chan->cap;
+    chan->len--;
+    sco_waitq_notify0(&chan->senders);
+    return true;
+}
+
+SCO_EXTERN
+void sco_chan_close(struct sco_chan *chan) {
+    chan->closed = true;
+    sco_waitq_notify_all(&chan->senders);
+    sco_waitq_notify_all(&chan->receivers);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reactor. Coroutines waiting on a file descriptor are paused by handle and
+// the handle is stored in the kernel's event data, so readiness maps straight
+// back to the coroutine without any fd table.
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__) && !defined(SCO_NOPOLL)
+#include <sys/epoll.h>
+#include <limits.h>
+#define SCO_EPOLL
+#elif (defined(__APPLE__) || defined(__FreeBSD__)) && !defined(SCO_NOPOLL)
+#include <sys/event.h>
+#define SCO_KQUEUE
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef SCO_POLLBATCH
+#define SCO_POLLBATCH 128
+#endif
+
+struct sco_waiter {
+    struct sco_handle handle;
+    int events;
+    int revents;
+};
+
+static int sco_poller(void) {
+    if (sco_pollfd == -1) {
+#if defined(SCO_EPOLL)
+        sco_pollfd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(SCO_KQUEUE)
+        sco_pollfd = kqueue();
+#else
+        errno = ENOSYS;
+#endif
+    }
+    return sco_pollfd;
+}
+
+// Arm a oneshot notification for the waiter.
+static int sco_poll_arm(int fd, struct sco_waiter *waiter) {
+    int pfd = sco_poller();
+    if (pfd == -1) {
+        return -1;
+    }
+#if defined(SCO_EPOLL)
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLONESHOT;
+    ev.events |= (waiter->events&SCO_READ) ? EPOLLIN : 0;
+    ev.events |= (waiter->events&SCO_WRITE) ? EPOLLOUT : 0;
+    ev.data.ptr = waiter;
+    // A descriptor stays registered after its oneshot fires, so try to
+    // rearm it first.
+    if (epoll_ctl(pfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        if (errno != ENOENT || epoll_ctl(pfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+#elif defined(SCO_KQUEUE)
+    struct kevent evs[2];
+    int n = 0;
+    if (waiter->events&SCO_READ) {
+        EV_SET(&evs[n++], fd, EVFILT_READ, EV_ADD|EV_ONESHOT, 0, 0, waiter);
+    }
+    if (waiter->events&SCO_WRITE) {
+        EV_SET(&evs[n++], fd, EVFILT_WRITE, EV_ADD|EV_ONESHOT, 0, 0, waiter);
+    }
+    return kevent(pfd, evs, n, NULL, 0, NULL) == -1 ? -1 : 0;
+#else
+    (void)fd; (void)waiter;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Remove any filter that is still armed after the waiter was woken.
+static void sco_poll_disarm(int fd, struct sco_waiter *waiter) {
+#if defined(SCO_KQUEUE)
+    if (waiter->events == (SCO_READ|SCO_WRITE)) {
+        struct kevent ev;
+        int filter = (waiter->revents&SCO_READ) ? EVFILT_WRITE : EVFILT_READ;
+        EV_SET(&ev, fd, filter, EV_DELETE, 0, 0, NULL);
+        kevent(sco_pollfd, &ev, 1, NULL, 0, NULL);
+    }
+#else
+    // The epoll oneshot disarms the whole descriptor.
+    (void)fd; (void)waiter;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timer wheel. A hierarchical wheel of SCO_TIMER_LEVELS levels, each with 64
+// slots, where a slot at level L spans 64^L ticks. Sleeping coroutines are
+// linked into the slots through their stack-resident struct sco, and remain
+// in the paused map so that they can be resumed early by id. Arming and 
+// cancelling a timer are constant time, and finding the next deadline only
+// scans the slot bitmaps.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+
+// The struct sco_wheel is part of struct sco_sched.
+
+static int64_t sco_clock(void) {
+    struct timespec now;
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return now.tv_sec*INT64_C(1000000000) + now.tv_nsec;
+}
+
+static int sco_ctz64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x&1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Add the coroutine into the wheel slot for its deadline tick, relative to 
+// the wheel's current tick.
+static void sco_timer_link(struct sco *co) {
+    struct sco_wheel *w = &sco_timers;
+    int64_t tick = (co->deadline+SCO_TIMER_TICK-1)/SCO_TIMER_TICK;
+    int64_t delta = tick - w->now;
+    int64_t max = (INT64_C(1)<<(6*SCO_TIMER_LEVELS))-1;
+    if (delta > max) {
+        tick = w->now + max;
+        delta = max;
+    }
+    int level = 0;
+    while (level < SCO_TIMER_LEVELS-1 && delta >= (INT64_C(1)<<(6*(level+1)))) {
+        level++;
+    }
+    int slot = (int)((tick>>(6*level))&63);
+    co->tlevel = (uint8_t)level;
+    co->tslot = (uint8_t)slot;
+    co->tnext = w->slots[level][slot];
+    co->tpprev = &w->slots[level][slot];
+    if (co->tnext) {
+        co->tnext->tpprev = &co->tnext;
+    }
+    w->slots[level][slot] = co;
+    w->bitmaps[level] |= UINT64_C(1)<<slot;
+}
+
+static void sco_timer_unlink(struct sco *co) {
+    struct sco_wheel *w = &sco_timers;
+    *co->tpprev = co->tnext;
+    if (co->tnext) {
+        co->tnext->tpprev = co->tpprev;
+    }
+    if (!w->slots[co->tlevel][co->tslot]) {
+        w->bitmaps[co->tlevel] &= ~(UINT64_C(1)<<co->tslot);
+    }
+    co->tnext = NULL;
+    co->tpprev = NULL;
+}
+
+// Arm the timer for a paused coroutine. Returns false if its deadline has
+// already passed.
+static bool sco_timer_arm(struct sco *co) {
+    struct sco_wheel *w = &sco_timers;
+    int64_t now = sco_clock();
+    if (co->deadline <= now) {
+        return false;
+    }
+    if (w->count == 0) {
+        // The wheel is idle, catch it up to the clock.
+        w->now = now/SCO_TIMER_TICK;
+    }
+    sco_timer_link(co);
+    w->count++;
+    return true;
+}
+
+static void sco_timer_cancel(struct sco *co) {
+    if (co->tpprev) {
+        sco_timer_unlink(co);
+        sco_timers.count--;
+    }
+}
+
+// Move the coroutine from the paused map to the yielders.
+static void sco_timer_wake(struct sco *co) {
+    sco_map_delete(&sco_paused, co);
+    sco_npaused--;
+    sco_stat(resumes);
+    sco_usdt1(resume, co->id);
+    sco_record1(SCO_EVENT_WAKE, co->id);
+    co->deadline = 0;
+    co->prev = co;
+    co->next = co;
+    sco_push_yielder(co);
+}
+
+// Redistribute the timers in the current slot of a level into the lower 
+// levels, starting from the highest level that rolled over.
+static void sco_timer_cascade(int level) {
+    struct sco_wheel *w = &sco_timers;
+    if (level >= SCO_TIMER_LEVELS) {
+        return;
+    }
+    int slot = (int)((w->now>>(6*level))&63);
+    if (slot == 0) {
+        sco_timer_cascade(level+1);
+    }
+    struct sco *co = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->bitmaps[level] &= ~(UINT64_C(1)<<slot);
+    while (co) {
+        struct sco *next = co->tnext;
+        sco_timer_link(co);
+        co = next;
+    }
+}
+
+// Wake all coroutines whose deadlines have passed by the time now.
+static void sco_timers_expire(int64_t now) {
+    struct sco_wheel *w = &sco_timers;
+    int64_t target = now/SCO_TIMER_TICK;
+    while (w->count > 0 && w->now < target) {
+        if (w->bitmaps[0] == 0 && w->now < (w->now|63)) {
+            // Nothing in the lowest level, skip to the end of its rotation.
+            w->now = (w->now|63) < target ? (w->now|63) : target;
+            if (w->now == target) {
+                break;
+            }
+        }
+        w->now++;
+        if ((w->now&63) == 0) {
+            sco_timer_cascade(1);
+        }
+        int slot = (int)(w->now&63);
+        struct sco *co = w->slots[0][slot];
+        w->slots[0][slot] = NULL;
+        w->bitmaps[0] &= ~(UINT64_C(1)<<slot);
+        while (co) {
+            struct sco *next = co->tnext;
+            co->tnext = NULL;
+            co->tpprev = NULL;
+            w->count--;
+            sco_timer_wake(co);
+            co = next;
+        }
+    }
+    if (w->count == 0) {
+        w->now = target;
+    }
+}
+
+#ifndef SCO_REPLAY_SLACK
+#define SCO_REPLAY_SLACK INT64_C(1000000000) // see sco_replay_causes()
+#endif
+
+// During a replay the sleeping coroutines are woken where the recording's
+// timers expired, rather than when their deadlines pass, even if that is
+// early. A timer that is SCO_REPLAY_SLACK past its deadline without showing
+// up in the log fires anyway, which ends the replay.
+static void sco_replay_causes(void) {
+    while (sco_rec_mode == SCO_REPLAYING) {
+        uint64_t ev = sco_replay_log[sco_replay_pos];
+        if (SCO_EVENT_TYPE(ev) != SCO_EVENT_WAKE) {
+            break;
+        }
+        struct sco *co = sco_map_search(&sco_paused, 
+            &(struct sco){ .id = SCO_EVENT_ID(ev) });
+        if (!co || !co->deadline) {
+            // Not asleep. The program has diverged from the recording.
+            sco_rec_mode = 0;
+            break;
+        }
+        sco_timer_cancel(co);
+        sco_timer_wake(co);
+    }
+}
+
+// Returns the wheel tick where the next timer might expire, or -1 if there
+// are no timers. Timers in a higher level may expire before the timers in a
+// lower one, thus every level is checked.
+static int64_t sco_timers_next(void) {
+    struct sco_wheel *w = &sco_timers;
+    int64_t next = -1;
+    for (int level = 0; level < SCO_TIMER_LEVELS; level++) {
+        if (!w->bitmaps[level]) {
+            continue;
+        }
+        int shift = 6*level;
+        int cur = (int)((w->now>>shift)&63);
+        // Rotate the bitmap so that the slot after the current one is first.
+        int rot = (cur+1)&63;
+        uint64_t bits = w->bitmaps[level];
+        bits = rot ? (bits>>rot)|(bits<<(64-rot)) : bits;
+        int dist = sco_ctz64(bits)+1;
+        // The start of the slot is the earliest possible expiry.
+        int64_t tick = ((w->now>>shift)+dist)<<shift;
+        tick = tick > w->now+1 ? tick : w->now+1;
+        if (next == -1 || tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// Take a coroutine out of the paused map, or return NULL if it's not there.
+static struct sco *sco_unpause(int64_t id) {
+    struct sco *co = sco_map_delete(&sco_paused, &(struct sco){ .id = id });
+    if (!co) {
+        return NULL;
+    }
+    sco_npaused--;
+    sco_stat(resumes);
+    sco_probe1(resume, co->id);
+    if (co->deadline) {
+        // Woken up early from sco_sleep().
+        sco_timer_cancel(co);
+        co->deadline = 0;
+    }
+    co->prev = co;
+    co->next = co;
+    return co;
+}
+
+// Move a paused coroutine to the yielders, without yielding.
+static bool sco_resume0(int64_t id) {
+    struct sco *co = sco_unpause(id);
+    if (!co) {
+        return false;
+    }
+    sco_push_yielder(co);
+    return true;
+}
+
+SCO_EXTERN
+bool sco_yield_to(int64_t id) {
+    if (!sco_cur) {
+        return false;
+    }
+    struct sco *co = sco_unpause(id);
+    if (!co) {
+        return false;
+    }
+    // Same as sco_yield(), but the next coroutine is the target instead of
+    // the front of the runners.
+    sco_stat(yields);
+    sco_slice_end(sco_cur);
+    sco_push_yielder(sco_cur);
+    sco_probe2(switch, sco_cur->id, co->id);
+    sco_cur = co;
+    sco_stat(switches);
+    sco_slice_begin();
+    llco_switch(co->llco, false);
+    sco_pool_flush();
+    return true;
+}
+
+SCO_EXTERN
+void sco_resume(int64_t id) {
+    sco_init();
+    if (id == 0 && !sco_cur) {
+        // Resuming from main
+        int64_t now = 0;
+        if (sco_rec_mode == SCO_REPLAYING) {
+            sco_replay_causes();
+            now = -SCO_REPLAY_SLACK;
+        }
+        if (sco_timers.count > 0) {
+            sco_timers_expire(sco_clock()+now);
+        }
+        sco_switch(true, false);
+    } else {
+        // Resuming from coroutine
+        if (sco_resume0(id)) {
+            sco_yield();
+        }
+    }
+}
+
+SCO_EXTERN
+size_t sco_resume_many_noyield(const int64_t *ids, size_t n) {
+    sco_init();
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += sco_resume0(ids[i]);
+    }
+    return count;
+}
+
+SCO_EXTERN
+size_t sco_resume_many(const int64_t *ids, size_t n) {
+    size_t count = sco_resume_many_noyield(ids, n);
+    if (count > 0) {
+        sco_yield();
+    }
+    return count;
+}
+
+SCO_EXTERN
+int64_t sco_now(void) {
+    return sco_clock();
+}
+
+SCO_EXTERN
+void sco_sleep_until(int64_t deadline) {
+    if (!sco_cur) {
+        return;
+    }
+    sco_cur->deadline = deadline > 0 ? deadline : 1;
+    if (!sco_timer_arm(sco_cur)) {
+        // Already passed
+        sco_cur->deadline = 0;
+        sco_yield();
+        return;
+    }
+    sco_map_insert(&sco_paused, sco_cur);
+    sco_npaused++;
+    sco_stat(pauses);
+    sco_probe1(pause, sco_cur->id);
+    sco_switch(false, false);
+}
+
+SCO_EXTERN
+void sco_sleep(int64_t nanosecs) {
+    sco_sleep_until(sco_clock()+(nanosecs > 0 ? nanosecs : 0));
+}
+
+SCO_EXTERN
+int64_t sco_next_deadline(void) {
+    if (sco_timers.count == 0) {
+        return -1;
+    }
+    int64_t tick = sco_timers_next();
+    int64_t timeout = tick*SCO_TIMER_TICK - sco_clock();
+    return timeout > 0 ? timeout : 0;
+}
+
+SCO_EXTERN
+size_t sco_info_sleeping(void) {
+    return sco_timers.count;
+}
+
+SCO_EXTERN
+void sco_detach(int64_t id) {
+    struct sco *co = sco_map_delete(&sco_paused, &(struct sco){ .id = id });
+    if (co) {
+        sco_npaused--;
+        // A sleeping coroutine keeps its deadline, which is armed again on
+        // the thread that attaches it.
+        sco_timer_cancel(co);
+        struct sco_shard *shard = sco_shard(id);
+        sco_lock(shard);
+        sco_aat_insert(&shard->root, co);
+        sco_unlock(shard);
+        atomic_fetch_add(&sco_ndetached, 1);
+        sco_probe1(detach, id);
+    }
+}
+
+SCO_EXTERN
+void sco_attach(int64_t id) {
+    struct sco_shard *shard = sco_shard(id);
+    sco_lock(shard);
+    struct sco *co = sco_aat_delete(&shard->root, &(struct sco){ .id = id });
+    sco_unlock(shard);
+    if (co) {
+        atomic_fetch_sub(&sco_ndetached, 1);
+        sco_probe1(attach, id);
+        sco_init();
+        sco_map_insert(&sco_paused, co);
+        sco_npaused++;
+        if (co->deadline && !sco_timer_arm(co)) {
+            sco_timer_wake(co);
+        }
+    }
+}
+
+SCO_EXTERN
+size_t sco_detach_many(const int64_t *ids, size_t n, struct sco_batch *batch) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct sco *co = sco_map_delete(&sco_paused, 
+            &(struct sco){ .id = ids[i] });
+        if (!co) {
+            continue;
+        }
+        sco_npaused--;
+        sco_timer_cancel(co);
+        co->next = batch->head;
+        batch->head = co;
+        count++;
+        sco_probe1(detach, co->id);
+    }
+    batch->count += count;
+    atomic_fetch_add(&sco_ndetached, count);
+    return count;
+}
+
+SCO_EXTERN
+size_t sco_attach_many(struct sco_batch *batch) {
+    sco_init();
+    size_t count = batch->count;
+    struct sco *co = batch->head;
+    while (co) {
+        struct sco *next = co->next;
+        sco_probe1(attach, co->id);
+        sco_map_insert(&sco_paused, co);
+        sco_npaused++;
+        if (co->deadline && !sco_timer_arm(co)) {
+            sco_timer_wake(co);
+        }
+        co = next;
+    }
+    *batch = (struct sco_batch){ 0 };
+    atomic_fetch_sub(&sco_ndetached, count);
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Inbox. A bounded lock-free queue of messages from any thread to the owning
+// thread, which drains it at the end of every scheduling round. Each slot
+// has a sequence number that tells the producers and the consumer whose turn
+// it is. When the owning thread blocks in sco_poll() it asks to be woken,
+// through an eventfd or a kqueue user event.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCO_INBOXSIZE
+#define SCO_INBOXSIZE 1024 // must be a power of two
+#endif
+
+#if defined(SCO_EPOLL)
+#include <sys/eventfd.h>
+#endif
+
+struct sco_inbox_slot {
+    atomic_size_t seq;
+    int64_t id;
+    bool adopt;
+};
+
+struct sco_inbox {
+    atomic_size_t tail;
+    char pad[64-sizeof(atomic_size_t)];
+    size_t head;
+    int wakefd;              // eventfd or kqueue, or -1
+    atomic_bool sleeping;    // the owner is about to block in sco_poll()
+    struct sco_inbox_slot slots[SCO_INBOXSIZE];
+};
+
+static bool sco_inbox_post(struct sco_inbox *inbox, int64_t id, bool adopt) {
+    size_t pos = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+    struct sco_inbox_slot *slot;
+    while (1) {
+        slot = &inbox->slots[pos&(SCO_INBOXSIZE-1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq-(intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&inbox->tail, &pos, 
+                pos+1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+        }
+    }
+    slot->id = id;
+    slot->adopt = adopt;
+    atomic_store(&slot->seq, pos+1);
+    if (atomic_load(&inbox->sleeping) && atomic_exchange(&inbox->sleeping, 
+        false))
+    {
+#if defined(SCO_EPOLL)
+        uint64_t one = 1;
+        ssize_t n = write(inbox->wakefd, &one, sizeof(one));
+        (void)n;
+#elif defined(SCO_KQUEUE)
+        struct kevent ev;
+        EV_SET(&ev, (uintptr_t)inbox, EVFILT_USER, 0, NOTE_TRIGGER, 0, inbox);
+        kevent(inbox->wakefd, &ev, 1, NULL, 0, NULL);
+#endif
+    }
+    return true;
+}
+
+static bool sco_inbox_empty(struct sco_inbox *inbox) {
+    struct sco_inbox_slot *slot = &inbox->slots[inbox->head&(SCO_INBOXSIZE-1)];
+    return atomic_load(&slot->seq) != inbox->head+1;
+}
+
+// Handle all messages in the calling thread's inbox.
+// Returns the number of coroutines that were scheduled.
+static size_t sco_inbox_drain(bool replay) {
+    struct sco_inbox *inbox = sco_tinbox;
+    size_t count = 0;
+    while (1) {
+        if (replay && sco_rec_mode == SCO_REPLAYING && 
+            SCO_EVENT_TYPE(sco_replay_log[sco_replay_pos]) != SCO_EVENT_POST)
+        {
+            // Messages are handled where the recording handled them.
+            break;
+        }
+        size_t head = inbox->head;
+        struct sco_inbox_slot *slot = &inbox->slots[head&(SCO_INBOXSIZE-1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != head+1) {
+            break;
+        }
+        int64_t id = slot->id;
+        bool adopt = slot->adopt;
+        atomic_store_explicit(&slot->seq, head+SCO_INBOXSIZE, 
+            memory_order_release);
+        inbox->head = head+1;
+        sco_record1(SCO_EVENT_POST, id);
+        if (adopt) {
+            sco_attach(id);
+        }
+        count += sco_resume0(id);
     }
+    return count;
 }
 
 SCO_EXTERN
-void sco_pause(void) {
-    if (sco_cur) {
-        sco_map_insert(&sco_paused, sco_cur);
-        sco_npaused++;
-        sco_switch(false, false);
+struct sco_inbox *sco_inbox_open(void) {
+    if (sco_tinbox) {
+        return sco_tinbox;
+    }
+    struct sco_inbox *inbox = malloc(sizeof(struct sco_inbox));
+    if (!inbox) {
+        return NULL;
+    }
+    atomic_init(&inbox->tail, 0);
+    inbox->head = 0;
+    inbox->wakefd = -1;
+    atomic_init(&inbox->sleeping, false);
+    for (size_t i = 0; i < SCO_INBOXSIZE; i++) {
+        atomic_init(&inbox->slots[i].seq, i);
+    }
+#if defined(SCO_EPOLL)
+    int pfd = sco_poller();
+    int efd = pfd == -1 ? -1 : eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (efd != -1) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = inbox };
+        if (epoll_ctl(pfd, EPOLL_CTL_ADD, efd, &ev) == -1) {
+            close(efd);
+            efd = -1;
+        }
+    }
+    inbox->wakefd = efd;
+#elif defined(SCO_KQUEUE)
+    int pfd = sco_poller();
+    if (pfd != -1) {
+        struct kevent ev;
+        EV_SET(&ev, (uintptr_t)inbox, EVFILT_USER, EV_ADD|EV_CLEAR, 0, 0, 
+            inbox);
+        if (kevent(pfd, &ev, 1, NULL, 0, NULL) != -1) {
+            inbox->wakefd = pfd;
+        }
     }
+#endif
+    sco_tinbox = inbox;
+    return inbox;
 }
 
 SCO_EXTERN
-void sco_resume(int64_t id) {
+void sco_inbox_close(void) {
+    struct sco_inbox *inbox = sco_tinbox;
+    if (!inbox) {
+        return;
+    }
     sco_init();
-    if (id == 0 && !sco_cur) {
-        // Resuming from main
-        sco_switch(true, false);
-    } else {
-        // Resuming from coroutine
-        struct sco *co = sco_map_delete(&sco_paused, &(struct sco){ .id = id });
-        if (co) {
-            sco_npaused--;
-            co->prev = co;
-            co->next = co;
-            sco_list_push_back(&sco_yielders, co);
-            sco_nyielders++;
-            sco_yield();
-        }
+    sco_inbox_drain(false);
+#if defined(SCO_EPOLL)
+    if (inbox->wakefd != -1) {
+        epoll_ctl(sco_pollfd, EPOLL_CTL_DEL, inbox->wakefd, NULL);
+        close(inbox->wakefd);
+    }
+#elif defined(SCO_KQUEUE)
+    if (inbox->wakefd != -1) {
+        struct kevent ev;
+        EV_SET(&ev, (uintptr_t)inbox, EVFILT_USER, EV_DELETE, 0, 0, NULL);
+        kevent(inbox->wakefd, &ev, 1, NULL, 0, NULL);
     }
+#endif
+    free(inbox);
+    sco_tinbox = NULL;
 }
 
 SCO_EXTERN
-void sco_detach(int64_t id) {
-    struct sco *co = sco_map_delete(&sco_paused, &(struct sco){ .id = id });
-    if (co) {
-        sco_npaused--;
-        sco_lock();
-        sco_map_insert(&sco_detached, co);
-        sco_ndetached++;
-        sco_unlock();
-    }
+bool sco_post_resume(struct sco_inbox *inbox, int64_t id) {
+    return sco_inbox_post(inbox, id, false);
 }
 
 SCO_EXTERN
-void sco_attach(int64_t id) {
-    sco_lock();
-    struct sco *co = sco_map_delete(&sco_detached, &(struct sco){ .id = id });
-    if (co) {
-        sco_ndetached--;
-    }
-    sco_unlock();
-    if (co) {
-        sco_map_insert(&sco_paused, co);
-        sco_npaused++;
-    }
+bool sco_post_adopt(struct sco_inbox *inbox, int64_t id) {
+    return sco_inbox_post(inbox, id, true);
 }
 
 SCO_EXTERN
@@ -1968,9 +4864,21 @@ void *sco_udata(void) {
     return sco_cur ? sco_cur->udata : NULL;
 }
 
+SCO_EXTERN
+void sco_set_priority(int priority) {
+    if (sco_cur) {
+        sco_cur->prio = sco_prio_index(priority);
+    }
+}
+
+SCO_EXTERN
+int sco_priority(void) {
+    return sco_cur ? (int)sco_cur->prio+SCO_PRIO_LOW : SCO_PRIO_NORMAL;
+}
+
 SCO_EXTERN
 size_t sco_info_scheduled(void) {
-    return sco_nyielders;
+    return sco_nyielders + sco_pool_count();
 }
 
 SCO_EXTERN
@@ -1990,17 +4898,325 @@ size_t sco_info_running(void) {
 
 SCO_EXTERN
 size_t sco_info_detached(void) {
-    sco_lock();
-    size_t ndetached = sco_ndetached;
-    sco_unlock();
-    return ndetached;
+    return atomic_load(&sco_ndetached);
+}
+
+SCO_EXTERN
+int64_t sco_cputime(void) {
+#ifdef SCO_STATS
+    if (sco_cur) {
+        return sco_cur->cputime + (sco_clock() - sco_slice_start);
+    }
+#endif
+    return -1;
+}
+
+SCO_EXTERN
+void sco_set_slice_hook(int64_t budget, 
+    void (*hook)(int64_t id, int64_t slice, void *udata), void *udata)
+{
+#ifdef SCO_STATS
+    sco_slice_budget = budget;
+    sco_slice_hook = hook;
+    sco_slice_udata = udata;
+#else
+    (void)budget, (void)hook, (void)udata;
+#endif
+}
+
+SCO_EXTERN
+bool sco_set_quantum(int64_t nanosecs) {
+    nanosecs = nanosecs < 0 ? 0 : nanosecs;
+#ifdef SCO_TICKER
+    // Whole ticks, rounded up.
+    int64_t quantum = (nanosecs+SCO_QUANTUM_TICK-1)/SCO_QUANTUM_TICK;
+#else
+    int64_t quantum = nanosecs;
+#endif
+    int delta = (quantum > 0) - (sco_quantum > 0);
+    if (delta != 0 && !sco_ticker_use(delta)) {
+        return false;
+    }
+    sco_quantum = quantum;
+    sco_quantum_begin();
+    return true;
+}
+
+SCO_EXTERN
+bool sco_maybe_yield(void) {
+    if (!sco_quantum || !sco_cur) {
+        return false;
+    }
+#ifdef SCO_TICKER
+    // A slice starts somewhere within a tick, so one more tick must pass to
+    // be sure that the whole quantum has.
+    if (sco_quantum_now()-sco_quantum_mark <= sco_quantum) {
+        return false;
+    }
+#else
+    if (sco_quantum_now()-sco_quantum_mark < sco_quantum) {
+        return false;
+    }
+#endif
+    sco_yield();
+    return true;
+}
+
+SCO_EXTERN
+bool sco_stats_get(struct sco_stats *stats) {
+#ifdef SCO_STATS
+    *stats = sco_tstats;
+    return true;
+#else
+    *stats = (struct sco_stats){ 0 };
+    return false;
+#endif
 }
 
 // Returns true if there are any coroutines running, yielding, or paused.
 SCO_EXTERN
 bool sco_active(void) {
     // Notice that detached coroutinues are not included.
-    return (sco_nyielders + sco_npaused + sco_nrunners + !!sco_cur) > 0;
+    return (sco_nyielders + sco_pool_count() + sco_npaused + sco_nrunners +
+        !!sco_cur) > 0;
+}
+
+SCO_EXTERN
+struct sco_sched *sco_sched_new(void) {
+    struct sco_sched *sched = aligned_alloc(_Alignof(struct sco_sched),
+        sizeof(struct sco_sched));
+    if (!sched) {
+        return NULL;
+    }
+    memset(sched, 0, sizeof(struct sco_sched));
+    sched->pollfd = -1;
+    return sched;
+}
+
+// Returns true if the scheduler has no coroutines and no inbox.
+static bool sco_sched_idle(struct sco_sched *sched) {
+    return !sched->cur && !sched->nrunners && !sched->nyielders &&
+        !sched->npaused && !sched->inbox;
+}
+
+// Free the memory that the scheduler has allocated, but not the scheduler.
+static void sco_sched_release(struct sco_sched *sched) {
+#ifdef SCO_HASHMAP
+    free(sched->paused.buckets);
+#endif
+#if defined(SCO_EPOLL) || defined(SCO_KQUEUE)
+    if (sched->pollfd != -1) {
+        close(sched->pollfd);
+    }
+#endif
+    if (sched->quantum) {
+        sco_ticker_use(-1);
+    }
+    for (int i = 0; i < SCO_NPRIOS; i++) {
+        sco_queue_free(&sched->runqs[i].runners);
+        sco_queue_free(&sched->runqs[i].yielders);
+    }
+    free(sched->rec_ring);
+}
+
+SCO_EXTERN
+bool sco_sched_free(struct sco_sched *sched) {
+    if (!sched || sched == &sco_tsched || sched == sco_tsp || 
+        !sco_sched_idle(sched))
+    {
+        return false;
+    }
+    sco_sched_release(sched);
+    free(sched);
+    return true;
+}
+
+SCO_EXTERN
+bool sco_thread_cleanup(void) {
+    if (sco_cur || !sco_sched_idle(&sco_tsched)) {
+        return false;
+    }
+    sco_sched_release(&sco_tsched);
+    // A later use of the thread starts over with a fresh scheduler.
+    sco_tsched = (struct sco_sched){ .pollfd = -1 };
+    return true;
+}
+
+SCO_EXTERN
+bool sco_sched_set(struct sco_sched *sched) {
+    if (sco_cur) {
+        return false;
+    }
+    sco_tsp = sched ? sched : &sco_tsched;
+    return true;
+}
+
+SCO_EXTERN
+struct sco_sched *sco_sched_get(void) {
+    return sco_S;
+}
+
+SCO_EXTERN
+int sco_node(void) {
+    if (sco_node_id < 0) {
+        sco_node_id = sco_node_detect();
+    }
+    return sco_node_id;
+}
+
+SCO_EXTERN
+void sco_set_node(int node) {
+    sco_node_id = node < 0 ? -1 : node;
+    if (sco_worker >= 0) {
+        atomic_store(&sco_worker_nodes[sco_worker], sco_node());
+    }
+}
+
+SCO_EXTERN
+bool sco_pool_join(void) {
+    if (sco_worker >= 0) {
+        return true;
+    }
+    for (int i = 0; i < SCO_MAXWORKERS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&sco_workers[i], &expected, true)) {
+            sco_init();
+            sco_worker = i;
+            atomic_store(&sco_worker_nodes[i], sco_node());
+            return true;
+        }
+    }
+    return false;
+}
+
+SCO_EXTERN
+void sco_pool_leave(void) {
+    if (sco_worker < 0) {
+        return;
+    }
+    // Take back whatever has not been stolen yet.
+    struct sco_deque *dq = &sco_deques[sco_worker];
+    struct sco_runq *rq = &sco_runqs[sco_prio_index(SCO_PRIO_NORMAL)];
+    size_t nyielders = rq->nyielders;
+    struct sco *co;
+    while ((co = sco_deque_steal(dq))) {
+        co->prev = co;
+        co->next = co;
+        sco_push_yielder(co);
+    }
+    // The pooled coroutines are older than the local ones.
+    for (size_t i = 0; i < nyielders; i++) {
+        sco_queue_push(&rq->yielders, sco_queue_pop(&rq->yielders));
+    }
+    atomic_store(&sco_workers[sco_worker], false);
+    sco_worker = -1;
+}
+
+SCO_EXTERN
+bool sco_pool_active(void) {
+    return atomic_load(&sco_pool_live) > 0;
+}
+
+SCO_EXTERN
+int sco_wait_fd(int fd, int events) {
+    if (!sco_cur || !(events&(SCO_READ|SCO_WRITE))) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct sco_waiter waiter = { 
+        .handle = sco_pause_handle(),
+        .events = events&(SCO_READ|SCO_WRITE),
+    };
+    if (sco_poll_arm(fd, &waiter) == -1) {
+        // Cancel the handle so the next pause is a normal one.
+        sco_cur->handled = false;
+        return -1;
+    }
+    sco_nwaiting++;
+    sco_pause();
+    sco_poll_disarm(fd, &waiter);
+    return waiter.revents;
+}
+
+SCO_EXTERN
+int sco_poll(int64_t timeout) {
+    struct sco_inbox *inbox = sco_tinbox;
+    if (sco_nwaiting == 0 && timeout < 0 && (!inbox || inbox->wakefd == -1)) {
+        // Nothing could ever wake up.
+        return 0;
+    }
+    int pfd = sco_poller();
+    if (pfd == -1) {
+        return -1;
+    }
+    if (inbox && timeout != 0) {
+        // Ask to be woken up by the next post, unless there is one already.
+        atomic_store(&inbox->sleeping, true);
+        if (!sco_inbox_empty(inbox)) {
+            timeout = 0;
+        }
+    }
+#if defined(SCO_EPOLL)
+    struct epoll_event evs[SCO_POLLBATCH];
+    int ms = -1;
+    if (timeout >= 0) {
+        // Round up to whole milliseconds without overflowing, and clamp to
+        // the longest timeout that epoll takes.
+        int64_t ms64 = timeout/1000000 + (timeout%1000000 != 0);
+        ms = ms64 > INT_MAX ? INT_MAX : (int)ms64;
+    }
+    int n = epoll_wait(pfd, evs, SCO_POLLBATCH, ms);
+#elif defined(SCO_KQUEUE)
+    struct kevent evs[SCO_POLLBATCH];
+    struct timespec ts = { 
+        .tv_sec = timeout/1000000000, 
+        .tv_nsec = timeout%1000000000,
+    };
+    int n = kevent(pfd, NULL, 0, evs, SCO_POLLBATCH, timeout < 0 ? NULL : &ts);
+#else
+    int n = -1;
+#endif
+    if (inbox) {
+        atomic_store(&inbox->sleeping, false);
+    }
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    int nresumed = 0;
+    for (int i = 0; i < n; i++) {
+#if defined(SCO_EPOLL)
+        if (evs[i].data.ptr == inbox) {
+            uint64_t val;
+            ssize_t nread = read(inbox->wakefd, &val, sizeof(val));
+            (void)nread;
+            nresumed += (int)sco_inbox_drain(true);
+            continue;
+        }
+        struct sco_waiter *waiter = evs[i].data.ptr;
+        int revents = 0;
+        if (evs[i].events&(EPOLLERR|EPOLLHUP)) {
+            // Let the coroutine find the error on its next read or write.
+            revents = waiter->events;
+        }
+        revents |= (evs[i].events&EPOLLIN) ? SCO_READ : 0;
+        revents |= (evs[i].events&EPOLLOUT) ? SCO_WRITE : 0;
+#elif defined(SCO_KQUEUE)
+        if (evs[i].filter == EVFILT_USER) {
+            nresumed += (int)sco_inbox_drain(true);
+            continue;
+        }
+        struct sco_waiter *waiter = evs[i].udata;
+        int revents = evs[i].filter == EVFILT_READ ? SCO_READ : SCO_WRITE;
+#endif
+#if defined(SCO_EPOLL) || defined(SCO_KQUEUE)
+        waiter->revents |= revents&waiter->events;
+        if (sco_resume_handle0(waiter->handle)) {
+            sco_nwaiting--;
+            nresumed++;
+        }
+#endif
+    }
+    return nresumed;
 }
 
 SCO_EXTERN
@@ -2047,3 +5263,268 @@ int sco_unwind(bool(*func)(struct sco_symbol *sym, void *udata), void *udata) {
     llco_unwind(sco_unwind_step, &ctx);
     return ctx.nsymbols_actual;
 }
+
+SCO_EXTERN
+int sco_unwind_ips(void **ips, int max) {
+    void *start_ip = 0;
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__)
+    start_ip = __builtin_return_address(0);
+#endif
+    return llco_backtrace(0, start_ip, ips, max);
+}
+
+SCO_EXTERN
+int sco_unwind_paused(int64_t id, void **ips, int max) {
+    struct sco *co = sco_map_search(&sco_paused, &(struct sco){ .id = id });
+    if (!co || !co->llco) {
+        return 0;
+    }
+    return llco_backtrace(co->llco, 0, ips, max);
+}
+
+SCO_EXTERN
+bool sco_symbolize(void *ip, struct sco_symbol *sym) {
+    struct llco_symbol llco_sym;
+    bool ok = llco_symbolize(ip, &llco_sym);
+    *sym = (struct sco_symbol){
+        .fbase = llco_sym.fbase,
+        .fname = llco_sym.fname,
+        .ip = llco_sym.ip,
+        .saddr = llco_sym.saddr,
+        .sname = llco_sym.sname,
+    };
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Coroutine dump. The iterator visits the running coroutine, the run queues,
+// the waiting and blocked lists, and then the paused map, remembering where
+// it stopped so that each batch only holds up the runloop for a moment.
+////////////////////////////////////////////////////////////////////////////////
+
+#define SCO_DUMP_RUNNING 0
+#define SCO_DUMP_RUNQ    1 // runners and yielders of each level
+#define SCO_DUMP_WAITING (SCO_DUMP_RUNQ+SCO_NPRIOS*2)
+#define SCO_DUMP_BLOCKED (SCO_DUMP_WAITING+1)
+#define SCO_DUMP_PAUSED  (SCO_DUMP_BLOCKED+1)
+#define SCO_DUMP_DONE    (SCO_DUMP_PAUSED+1)
+
+// Drop the dump cursor, if any.
+static void sco_dump_unmark(struct sco_sched *S) {
+    struct sco *co = S->dump_cursor;
+    if (co && co != (struct sco*)&S->dump_list->tail) {
+        co->dumpmark = false;
+    }
+    S->dump_cursor = NULL;
+}
+
+// Visit the list, continuing where the previous batch stopped. The batch
+// leaves a cursor on the next coroutine, which sco_remove_from_list() moves
+// along when that coroutine leaves the list, so that a batch doesn't have to
+// walk over the coroutines that were already visited. Only the iterator
+// whose token is in iter->last owns the cursor. Any other iterator skips
+// the iter->pos coroutines from the front instead.
+static size_t sco_dump_list(struct sco_dump_iter *iter, struct sco_list *list,
+    int state, size_t n, void(*func)(struct sco *co, int state, void *udata),
+    void *udata)
+{
+    struct sco_sched *S = sco_S;
+    struct sco *end = (struct sco*)&list->tail;
+    struct sco *co;
+    if (iter->pos > 0 && iter->last == S->dump_token && S->dump_cursor &&
+        S->dump_list == list && list->gen == S->dump_list_gen)
+    {
+        co = S->dump_cursor;
+    } else {
+        co = list->head.next;
+        for (size_t i = 0; i < iter->pos && co != end; i++) {
+            co = co->next;
+        }
+    }
+    size_t count = 0;
+    while (co != end && count < n) {
+        func(co, state, udata);
+        iter->pos++;
+        count++;
+        co = co->next;
+    }
+    sco_dump_unmark(S);
+    if (co == end) {
+        iter->phase++;
+        iter->pos = 0;
+        iter->last = 0;
+    } else {
+        co->dumpmark = true;
+        S->dump_cursor = co;
+        S->dump_list = list;
+        S->dump_list_gen = list->gen;
+        iter->last = ++S->dump_token;
+    }
+    return count;
+}
+
+static size_t sco_dump_queue(struct sco_dump_iter *iter, struct sco_queue *q,
+    size_t n, void(*func)(struct sco *co, int state, void *udata),
+    void *udata)
+{
+#ifdef SCO_RINGQ
+    size_t count = 0;
+    size_t total = sco_queue_count(q);
+    while (iter->pos < total && count < n) {
+        func(sco_queue_at(q, iter->pos), SCO_STATE_SCHEDULED, udata);
+        iter->pos++;
+        count++;
+    }
+    if (iter->pos >= total) {
+        iter->phase++;
+        iter->pos = 0;
+    }
+    return count;
+#else
+    return sco_dump_list(iter, &q->list, SCO_STATE_SCHEDULED, n, func, udata);
+#endif
+}
+
+static size_t sco_dump_paused(struct sco_dump_iter *iter, size_t n,
+    void(*func)(struct sco *co, int state, void *udata), void *udata)
+{
+    size_t count = 0;
+#ifdef SCO_HASHMAP
+    while (count < n && iter->pos < sco_paused.cap) {
+        struct sco *co = sco_paused.buckets[iter->pos].co;
+        if (co) {
+            func(co, co->deadline ? SCO_STATE_SLEEPING : SCO_STATE_PAUSED,
+                udata);
+            count++;
+        }
+        iter->pos++;
+    }
+    if (iter->pos >= sco_paused.cap) {
+        iter->phase++;
+    }
+#else
+    // Each shard is visited in id order, continuing after the last id.
+    while (count < n && iter->pos < SCO_NSHARDS) {
+        struct sco **root = &sco_paused.roots[iter->pos];
+        struct sco *co = sco_aat_iter(root, &(struct sco){ .id = iter->last+1 });
+        while (co && count < n) {
+            func(co, co->deadline ? SCO_STATE_SLEEPING : SCO_STATE_PAUSED,
+                udata);
+            iter->last = co->id;
+            count++;
+            co = sco_aat_next(root, co);
+        }
+        if (!co) {
+            iter->pos++;
+            iter->last = 0;
+        }
+    }
+    if (iter->pos >= SCO_NSHARDS) {
+        iter->phase++;
+    }
+#endif
+    return count;
+}
+
+// Visit up to n coroutines from where the iterator left off.
+static size_t sco_dump0(struct sco_dump_iter *iter, size_t n,
+    void(*func)(struct sco *co, int state, void *udata), void *udata)
+{
+    sco_init();
+    size_t count = 0;
+    while (count < n && iter->phase >= 0 && iter->phase < SCO_DUMP_DONE) {
+        if (iter->phase == SCO_DUMP_RUNNING) {
+            if (sco_cur) {
+                func(sco_cur, SCO_STATE_RUNNING, udata);
+                count++;
+            }
+            iter->phase++;
+        } else if (iter->phase < SCO_DUMP_WAITING) {
+            // Highest priority level first.
+            int i = SCO_NPRIOS-1-(iter->phase-SCO_DUMP_RUNQ)/2;
+            struct sco_queue *q = (iter->phase-SCO_DUMP_RUNQ)%2 == 0 ?
+                &sco_runqs[i].runners : &sco_runqs[i].yielders;
+            count += sco_dump_queue(iter, q, n-count, func, udata);
+        } else if (iter->phase == SCO_DUMP_WAITING) {
+            count += sco_dump_list(iter, &sco_hpaused, SCO_STATE_WAITING,
+                n-count, func, udata);
+        } else if (iter->phase == SCO_DUMP_BLOCKED) {
+            count += sco_dump_list(iter, &sco_blocked, SCO_STATE_BLOCKED,
+                n-count, func, udata);
+        } else {
+            count += sco_dump_paused(iter, n-count, func, udata);
+        }
+    }
+    return count;
+}
+
+static void sco_dump_fill(struct sco *co, int state, void *udata) {
+    struct sco_dump_info **info = udata;
+    **info = (struct sco_dump_info){
+        .id = co->id,
+        .state = state,
+        .priority = (int)co->prio+SCO_PRIO_LOW,
+        .udata = co->udata,
+        .stack = co->stack,
+        .stack_size = co->stack_size,
+    };
+    (*info)++;
+}
+
+SCO_EXTERN
+size_t sco_dump(struct sco_dump_iter *iter, struct sco_dump_info *infos,
+    size_t n)
+{
+    return sco_dump0(iter, n, sco_dump_fill, &infos);
+}
+
+struct sco_dump_stacks_ctx {
+    struct sco_stack_sig *sigs;
+    size_t *nsigs;
+    size_t cap;
+};
+
+static void sco_dump_stack(struct sco *co, int state, void *udata) {
+    struct sco_dump_stacks_ctx *ctx = udata;
+    void *ips[SCO_STACKSIG_DEPTH];
+    int nips = 0;
+    if (state != SCO_STATE_RUNNING && co->llco) {
+        nips = llco_backtrace(co->llco, 0, ips, SCO_STACKSIG_DEPTH);
+    }
+    // FNV-1a over the return addresses, with zero meaning no stack.
+    uint64_t hash = 0;
+    if (nips > 0) {
+        hash = UINT64_C(0xcbf29ce484222325);
+        for (int i = 0; i < nips; i++) {
+            hash = (hash^(uint64_t)(uintptr_t)ips[i])*UINT64_C(0x100000001b3);
+        }
+        hash = hash ? hash : 1;
+    }
+    for (size_t i = 0; i < *ctx->nsigs; i++) {
+        struct sco_stack_sig *sig = &ctx->sigs[i];
+        if (sig->hash == hash && sig->nips == nips &&
+            memcmp(sig->ips, ips, sizeof(void*)*(size_t)nips) == 0)
+        {
+            sig->count++;
+            return;
+        }
+    }
+    if (*ctx->nsigs == ctx->cap) {
+        return;
+    }
+    struct sco_stack_sig *sig = &ctx->sigs[(*ctx->nsigs)++];
+    sig->hash = hash;
+    sig->count = 1;
+    sig->id = co->id;
+    sig->nips = nips;
+    memcpy(sig->ips, ips, sizeof(void*)*(size_t)nips);
+}
+
+SCO_EXTERN
+size_t sco_dump_stacks(struct sco_dump_iter *iter, size_t n,
+    struct sco_stack_sig *sigs, size_t *nsigs, size_t cap)
+{
+    struct sco_dump_stacks_ctx ctx = { .sigs = sigs, .nsigs = nsigs, 
+        .cap = cap };
+    return sco_dump0(iter, n, sco_dump_stack, &ctx);
+}
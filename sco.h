@@ -13,21 +13,102 @@
 
 #define SCO_MINSTACKSIZE 131072 // Recommended minimum stack size
 
+#define SCO_READ  1 // sco_wait_fd() flag
+#define SCO_WRITE 2 // sco_wait_fd() flag
+
+#define SCO_PRIO_LOW    -1 // sco_desc.priority for background work
+#define SCO_PRIO_NORMAL  0 // sco_desc.priority default
+#define SCO_PRIO_HIGH    1 // sco_desc.priority for latency-sensitive work
+
+// A coroutine description. Zero-initialize it, such as with a designated
+// initializer, because fields added in later versions are read too.
 struct sco_desc {
     void *stack;
     size_t stack_size;
     void (*entry)(void *udata);
     void (*cleanup)(void *stack, size_t stack_size, void *udata);
     void *udata;
+    int priority;  // SCO_PRIO_LOW, SCO_PRIO_NORMAL, or SCO_PRIO_HIGH
+    struct sco_group *group; // Optional group to join, see sco_group_wait()
+};
+
+struct sco_inbox;
+struct sco_sched;
+struct sco_group;
+
+struct sco_handle {
+    void *co;
+    uint64_t gen;
+};
+
+struct sco_stack_info {
+    void *stack;          // Lowest address of the stack
+    size_t stack_size;    // Size of the stack
+    size_t resident;      // Bytes currently in physical memory
+    size_t highwater;     // Deepest resident byte, from the top of the stack
 };
 
-// Starts a new coroutine with the provided description.
+// Starts a new coroutine with the provided description. The description
+// must be zero-initialized, so that the fields the caller leaves out, such
+// as priority and group, are zero.
 void sco_start(struct sco_desc *desc);
 
+// Queues a new coroutine with the provided description, without switching
+// to it. The coroutine is created the first time it's scheduled, which is
+// after the caller yields or pauses, or at the next sco_resume(0) when called
+// from the runloop. The top of desc->stack holds the coroutine's bookkeeping
+// until then, and the rest of the stack is given to the coroutine.
+// Returns the id of the new coroutine.
+int64_t sco_spawn(struct sco_desc *desc);
+
+// Queues many new coroutines at once, same as calling sco_spawn() for each.
+// The optional ids array receives the id of each coroutine.
+void sco_spawn_many(struct sco_desc *descs, size_t n, int64_t *ids);
+
+// Starts a new coroutine using a stack from the thread's stack pool.
+// The desc->stack field is ignored and the stack_size is rounded up to a size
+// class, with zero meaning SCO_MINSTACKSIZE. The optional desc->cleanup is
+// called before the stack goes back to the pool, and it must not free it.
+void sco_start_pooled(struct sco_desc *desc);
+
+// Starts a new coroutine like sco_start_pooled(), but as a worker that is
+// parked when the entry returns, rather than finishing. A later call with a
+// stack_size of the same size class reuses a parked worker, switching into
+// it with the new entry and udata, which avoids creating a new context and
+// cleaning up the stack. Every run gets a new id. The desc->cleanup field is
+// ignored. Up to SCO_WORKER_MAXIDLE workers are parked per size class, and
+// sco_stack_trim() also finishes all of the parked workers.
+void sco_start_worker(struct sco_desc *desc);
+
+// Free all of the calling thread's cached pool stacks.
+void sco_stack_trim(void);
+
+// Get the stack memory usage of the current coroutine.
+// The resident field is the number of bytes backed by physical memory and 
+// the highwater field is the distance from the top of the stack to the
+// deepest resident page, which is the most stack that the coroutine, or any
+// previous user of the same memory, has touched.
+// Returns false if not called from a coroutine, or if the system cannot
+// report resident memory.
+bool sco_stack_info(struct sco_stack_info *info);
+
 // Causes the calling coroutine to relinquish the CPU.
 // This operation should be called from a coroutine, otherwise it does nothing.
 void sco_yield(void);
 
+// Set the quantum, in nanoseconds, that a coroutine may run for before
+// sco_maybe_yield() yields, or zero to never yield. The quantum is rounded
+// up to whole SCO_QUANTUM_TICK ticks of a shared ticker thread, which only
+// runs while some scheduler has a quantum. This applies to the calling
+// thread's current scheduler. Returns false if the ticker could not start.
+bool sco_set_quantum(int64_t nanosecs);
+
+// Yield if the current coroutine has run for longer than the quantum since
+// it was last switched to. Cheap enough to call in tight loops, it costs a
+// load and a compare until the quantum is up.
+// Returns true if it yielded.
+bool sco_maybe_yield(void);
+
 // Get the identifier for the current coroutine.
 // This operation should be called from a coroutine, otherwise it returns zero.
 int64_t sco_id(void);
@@ -43,9 +124,195 @@ void sco_pause(void);
 // README for an example.
 void sco_resume(int64_t id);
 
+// Switch directly to a paused coroutine, skipping over the other scheduled
+// coroutines. The current coroutine is rescheduled as if it had yielded.
+// Returns false, without yielding, if the id does not belong to a paused
+// coroutine.
+// This operation should be called from a coroutine, otherwise it returns
+// false.
+bool sco_yield_to(int64_t id);
+
+// Resume many paused coroutines at once, and then yield only one time.
+// Ids that are invalid or do not belong to paused coroutines are skipped.
+// Returns the number of coroutines that were resumed.
+size_t sco_resume_many(const int64_t *ids, size_t n);
+
+// Same as sco_resume_many() but without yielding. The resumed coroutines are
+// scheduled to run at the next yield, pause, or sco_resume(0) runloop step.
+size_t sco_resume_many_noyield(const int64_t *ids, size_t n);
+
+// Returns a handle that can resume the current coroutine after its next
+// call to sco_pause(), without looking up the coroutine by its id.
+// A coroutine paused this way can only be resumed with sco_resume_handle(),
+// and it cannot be detached. The handle must be used from the same thread.
+// Using a handle after its coroutine has completed is undefined behavior,
+// because the handle points into the coroutine's freed stack.
+// This operation should be called from a coroutine, otherwise it returns an
+// empty handle.
+struct sco_handle sco_pause_handle(void);
+
+// Resume a coroutine that was paused after a call to sco_pause_handle().
+// Returns false if the handle is stale, such as when the coroutine has 
+// already been resumed or it has since requested a newer handle. This check
+// only works while the coroutine still exists, see sco_pause_handle().
+bool sco_resume_handle(struct sco_handle handle);
+
 // Returns true if there are any coroutines running, yielding, or paused.
 bool sco_active(void);
 
+// Create a scheduler. Each thread starts with its own default scheduler, and
+// sco_sched_set() makes another one current for the calling thread, so that
+// several independent schedulers can take turns on one thread. All of the
+// operations above use the calling thread's current scheduler.
+// Returns NULL if out of memory.
+struct sco_sched *sco_sched_new(void);
+
+// Free a scheduler from sco_sched_new(). Returns false, and does nothing, if
+// the scheduler is current, still has coroutines, or has an open inbox.
+bool sco_sched_free(struct sco_sched *sched);
+
+// Free the memory held by the calling thread's default scheduler, such as
+// its run queues, which is not freed when the thread exits. Threads that are
+// done with coroutines should call it, along with sco_stack_trim(), before
+// exiting. The default scheduler can be used again afterwards.
+// Returns false, and does nothing, if called from a coroutine, or if the
+// default scheduler still has coroutines or an open inbox.
+bool sco_thread_cleanup(void);
+
+// Make the scheduler current for the calling thread, or NULL for the thread's
+// default scheduler. A scheduler must only be used by one thread at a time.
+// Returns false if called from a coroutine.
+bool sco_sched_set(struct sco_sched *sched);
+
+// Returns the calling thread's current scheduler.
+struct sco_sched *sco_sched_get(void);
+
+// Returns the current time of the monotonic clock, in nanoseconds.
+int64_t sco_now(void);
+
+// Pause the current coroutine for the provided number of nanoseconds.
+// The sleeping coroutine counts as paused and can be woken up early using
+// sco_resume(). Timers are processed by sco_resume(0) in the runloop.
+// This operation should be called from a coroutine, otherwise it does nothing.
+void sco_sleep(int64_t nanosecs);
+
+// Pause the current coroutine until the deadline, which is a sco_now() time.
+// This operation should be called from a coroutine, otherwise it does nothing.
+void sco_sleep_until(int64_t deadline);
+
+// Returns the number of nanoseconds until the next sleeping coroutine may
+// need to be woken up, zero if one is already due, or -1 if nobody sleeps.
+// This is suitable as the timeout for sco_poll().
+int64_t sco_next_deadline(void);
+
+// Synchronization primitives for coroutines on the same thread.
+// Waiters are queued in FIFO order and count as paused while waiting. They
+// are woken without any lookup and cannot be resumed by id or detached.
+// All of the structures can be zero-initialized, and the blocking
+// operations return false, without blocking, when not called from a
+// coroutine or when called from a thread in the worker pool, because the
+// pool could move the woken coroutines to other threads.
+struct sco_waitq {
+    void *head;
+    void *tail;
+    size_t count;         // Number of waiting coroutines
+};
+
+// Pause the current coroutine until notified.
+bool sco_waitq_wait(struct sco_waitq *wq);
+
+// Schedule the longest waiting coroutine, without yielding.
+// Returns false if there were no waiters.
+bool sco_waitq_notify(struct sco_waitq *wq);
+
+// Schedule all waiting coroutines, without yielding.
+// Returns the number of coroutines scheduled.
+size_t sco_waitq_notify_all(struct sco_waitq *wq);
+
+// Mutual exclusion lock. Unlocking hands the lock directly to the next
+// waiter, if any.
+struct sco_mutex {
+    bool locked;
+    struct sco_waitq waiters;
+};
+
+bool sco_mutex_lock(struct sco_mutex *mu);
+bool sco_mutex_trylock(struct sco_mutex *mu);
+void sco_mutex_unlock(struct sco_mutex *mu);
+
+// Counting semaphore. Set the count field for the initial value.
+struct sco_sem {
+    size_t count;
+    struct sco_waitq waiters;
+};
+
+bool sco_sem_wait(struct sco_sem *sem);
+bool sco_sem_trywait(struct sco_sem *sem);
+void sco_sem_post(struct sco_sem *sem);
+
+// Group of coroutines to wait for. A coroutine joins the group when it's
+// started with the group in its sco_desc, and leaves when it finishes. The
+// members and the waiters must stay on the thread that started them, so
+// coroutines started from a thread in the worker pool don't join the group.
+struct sco_group {
+    size_t count;         // Number of unfinished coroutines
+    struct sco_waitq waiters;
+};
+
+// Wait until every coroutine in the group has finished. The last one to
+// finish schedules the waiters directly. Returns false, without waiting,
+// when called from a thread in the worker pool.
+bool sco_group_wait(struct sco_group *group);
+
+// Bounded channel of fixed size elements.
+struct sco_chan {
+    void *buf;
+    size_t elsize;
+    size_t cap;
+    size_t head;
+    size_t len;           // Number of buffered elements
+    bool closed;
+    struct sco_waitq senders;
+    struct sco_waitq receivers;
+};
+
+// Initialize a channel that uses the provided buffer, which must have room
+// for cap elements of elsize bytes each. The cap must be at least one.
+void sco_chan_init(struct sco_chan *chan, void *buf, size_t elsize, 
+    size_t cap);
+
+// Copy the element into the channel, waiting while the channel is full.
+// Returns false if the channel is closed.
+bool sco_chan_send(struct sco_chan *chan, const void *elem);
+
+// Copy the next element out of the channel, waiting while it's empty.
+// Returns false if the channel is closed and there is nothing left.
+bool sco_chan_recv(struct sco_chan *chan, void *elem);
+
+// Close the channel and schedule all of its waiting coroutines. The
+// elements that were already sent can still be received.
+void sco_chan_close(struct sco_chan *chan);
+
+// Pause the current coroutine until the file descriptor is ready for reading
+// or writing, as requested with the SCO_READ and SCO_WRITE flags.
+// The coroutine is woken up by sco_poll(). Only one coroutine should wait on
+// a file descriptor at a time, and the file descriptor must not be closed
+// while it is waited on.
+// Returns the flags that are ready, or -1 on error with errno set.
+// This operation should be called from a coroutine, otherwise it fails with
+// EINVAL.
+int sco_wait_fd(int fd, int events);
+
+// Wait for file descriptors on the current thread to become ready, then
+// schedule all coroutines that are waiting on them in one pass.
+// The timeout is in nanoseconds, with zero meaning return immediately and
+// -1 meaning wait forever. Returns immediately if there is nothing to wait
+// for and the timeout is -1.
+// Returns the number of coroutines scheduled or -1 on error.
+// This operation is intended to be called from the runloop. See the README
+// for an example.
+int sco_poll(int64_t timeout);
+
 // Detach a coroutine from a thread.
 // This allows for moving coroutines between threads.
 // The coroutine must be currently paused before it can be detached, thus this
@@ -61,6 +328,46 @@ void sco_detach(int64_t id);
 // Once attached, the coroutine will be paused.
 void sco_attach(int64_t id);
 
+// A list of detached coroutines, see sco_detach_many(). Zero-initialize it.
+struct sco_batch {
+    void *head;
+    size_t count;         // Number of coroutines in the batch
+};
+
+// Detach the paused coroutines into the batch, linking them through their
+// own memory instead of the shared detached store, thus without any locks.
+// Ids that don't belong to a paused coroutine are skipped.
+// Returns the number of coroutines added to the batch.
+size_t sco_detach_many(const int64_t *ids, size_t n, struct sco_batch *batch);
+
+// Attach all of the coroutines in the batch to the calling thread, where
+// they will be paused, and empty the batch. The batch may be handed to
+// another thread by any means that synchronizes the two threads, such as a
+// mutex. Returns the number of coroutines attached.
+size_t sco_attach_many(struct sco_batch *batch);
+
+// Open the calling thread's inbox, which lets other threads resume or hand
+// over coroutines to this thread without any locks. Messages are handled
+// by this thread at the end of each scheduling round, such as at each
+// sco_resume(0) in the runloop, and a thread that is blocked in sco_poll()
+// is woken up by new messages. Returns the same inbox if it's already open,
+// or NULL if out of memory.
+struct sco_inbox *sco_inbox_open(void);
+
+// Handle any remaining messages and close the calling thread's inbox.
+// No other thread may post to it afterwards.
+void sco_inbox_close(void);
+
+// Ask the inbox's thread to resume a coroutine that is paused on it.
+// As with sco_resume(), the message is ignored if the coroutine is not
+// paused there when the message is handled.
+// Returns false if the inbox is full. This can be called from any thread.
+bool sco_post_resume(struct sco_inbox *inbox, int64_t id);
+
+// Ask the inbox's thread to attach and then resume a detached coroutine.
+// Returns false if the inbox is full. This can be called from any thread.
+bool sco_post_adopt(struct sco_inbox *inbox, int64_t id);
+
 // Exit a coroutine early.
 // This _will not_ exit the program. Rather, it's for ending the current 
 // coroutine and quickly switching to the thread's runloop before any other
@@ -71,13 +378,99 @@ void sco_exit(void);
 // Returns the user data of the currently running coroutine.
 void *sco_udata(void);
 
+// Set the priority of the current coroutine, which takes effect the next
+// time it's scheduled. Higher priority coroutines run before lower ones, but
+// a lower priority level never waits for more than SCO_PRIO_STARVE turns.
+// Only coroutines with the normal priority can be stolen by a worker pool.
+// This operation should be called from a coroutine, otherwise it does nothing.
+void sco_set_priority(int priority);
+
+// Returns the priority of the current coroutine.
+int sco_priority(void);
+
+// Returns the NUMA node of the calling thread. Unless set with
+// sco_set_node(), it's the node of the CPU that the thread was running on
+// when first asked, so threads should be pinned to their CPUs beforehand.
+int sco_node(void);
+
+// Set the NUMA node of the calling thread. Pool threads steal from threads
+// on the same node first, and from other nodes only when those have a
+// backlog of SCO_NUMA_IMBALANCE coroutines. On Linux, new pooled stacks of
+// a thread with a known node are allocated on that node. Also, when moving
+// coroutines with sco_detach() and sco_attach(), prefer a thread with the
+// same sco_node() as the one the coroutine was started on.
+// Passing -1 clears the node.
+void sco_set_node(int node);
+
+// Join the calling thread to the process-wide work-stealing pool.
+// While joined, the coroutines that yield on this thread may be stolen and
+// run by other idle threads in the pool, and when this thread runs out of
+// work it will steal from the others. A stolen coroutine belongs to the
+// thread that stole it, thus it must be resumed, detached, etc. from there.
+// For the same reason the synchronization primitives don't block and groups
+// aren't joined on a pool thread.
+// Returns false if the pool already has SCO_MAXWORKERS threads.
+bool sco_pool_join(void);
+
+// Leave the work-stealing pool.
+// Any coroutines that have not been stolen stay on the calling thread.
+void sco_pool_leave(void);
+
+// Returns true if there are any coroutines, that were started from a pool
+// thread, still running, yielding, paused, or detached on any thread.
+bool sco_pool_active(void);
+
 // General information and statistics
 size_t sco_info_scheduled(void);
 size_t sco_info_running(void);
 size_t sco_info_paused(void);
 size_t sco_info_detached(void);
+size_t sco_info_sleeping(void);
+size_t sco_info_stacks(void);
+size_t sco_info_workers(void);
 const char *sco_info_method(void);
 
+// Scheduler counters for the calling thread, when built with SCO_STATS.
+// All counters only ever increase. The wait fields measure how long
+// coroutines sat in the run queue before being switched to, where
+// wait_hist[i] counts waits shorter than 2^i nanoseconds and at least
+// 2^(i-1), with the last bucket holding all of the longer waits.
+#define SCO_STATS_NBUCKETS 32
+
+struct sco_stats {
+    uint64_t starts;      // coroutines started
+    uint64_t exits;       // coroutines finished
+    uint64_t switches;    // context switches into a coroutine
+    uint64_t yields;      // calls to sco_yield()
+    uint64_t pauses;      // calls to sco_pause(), including sleeps and waits
+    uint64_t resumes;     // paused coroutines resumed, including timers
+    uint64_t waits;       // run queue waits measured
+    uint64_t wait_ns;     // total run queue wait time
+    uint64_t wait_hist[SCO_STATS_NBUCKETS];
+    uint64_t lock_waits;  // detached store locks that were already held
+    uint64_t lock_wait_ns; // total time spent waiting for those locks
+};
+
+// Copy the calling thread's counters into stats.
+// Returns false, with stats zeroed, if the library was not built with
+// SCO_STATS.
+bool sco_stats_get(struct sco_stats *stats);
+
+// Returns the time that the current coroutine has spent running, in
+// nanoseconds, or -1 if not called from a coroutine or if the library was
+// not built with SCO_STATS.
+int64_t sco_cputime(void);
+
+// Set a hook that is called when a coroutine runs for longer than the
+// budget, in nanoseconds, before yielding, pausing or finishing. The hook
+// is called on the offending coroutine's stack just before it switches out,
+// so it can use sco_unwind() to find where the coroutine gave up the CPU.
+// The hook must not yield, pause, or start coroutines. Passing NULL removes
+// the hook. This applies to the calling thread and requires SCO_STATS,
+// otherwise it does nothing.
+void sco_set_slice_hook(int64_t budget,
+    void (*hook)(int64_t id, int64_t slice, void *udata), void *udata);
+
 // Coroutine stack unwinding
 struct sco_symbol {
     void *cfa;            // Canonical Frame Address
@@ -91,4 +484,129 @@ struct sco_symbol {
 // Unwinds the stack and returns the number of symbols
 int sco_unwind(bool (*func)(struct sco_symbol *sym, void *udata), void *udata);
 
+// Store up to max instruction pointers of the current coroutine's stack into
+// ips, without looking up their symbols. This follows frame pointers, so the
+// program should be built with -fno-omit-frame-pointer. It only reads the
+// coroutine's stack and does not lock or allocate, thus it's safe to call
+// from a signal handler, such as a sampling profiler's.
+// Returns the number of ips, which is zero if not called from a coroutine
+// or if the coroutine method is not asm on x64, i386, aarch64 or riscv.
+int sco_unwind_ips(void **ips, int max);
+
+// Same as sco_unwind_ips() but for a coroutine that is paused on the calling
+// thread, starting from where it paused. Returns zero if the id does not
+// belong to a paused coroutine.
+int sco_unwind_paused(int64_t id, void **ips, int max);
+
+// Look up the symbol for an instruction pointer, such as one from
+// sco_unwind_ips(). The results are cached per thread. The cfa field is not
+// set. Returns false if nothing is known about the address.
+bool sco_symbolize(void *ip, struct sco_symbol *sym);
+
+// Scheduler events. Each recorded event is a uint64_t with the type in the
+// top 8 bits and the coroutine id in the rest.
+#define SCO_EVENT_START  1 // a new coroutine begins running
+#define SCO_EVENT_SWITCH 2 // switched to a coroutine, or zero for the runloop
+#define SCO_EVENT_PAUSE  3
+#define SCO_EVENT_RESUME 4 // moved from paused to scheduled, but not by a timer
+#define SCO_EVENT_DETACH 5
+#define SCO_EVENT_ATTACH 6
+#define SCO_EVENT_EXIT   7
+#define SCO_EVENT_WAKE   8 // a sleeping coroutine's timer expired
+#define SCO_EVENT_POST   9 // an inbox message for the coroutine was handled
+#define SCO_EVENT_IDMASK UINT64_C(0x00ffffffffffffff)
+#define SCO_EVENT_TYPE(ev) ((int)((ev)>>56))
+#define SCO_EVENT_ID(ev) ((int64_t)((ev)&SCO_EVENT_IDMASK))
+
+// Start recording the calling thread's scheduler events into a ring buffer
+// that keeps the most recent cap events, rounded up to a power of two.
+// Recording costs a store per event, so it may be left on. A switch to the
+// runloop is only recorded when a coroutine was running, so a runloop that
+// polls while there is nothing to run does not add events.
+// Returns false if out of memory or already recording or replaying.
+bool sco_record_start(size_t cap);
+
+// Copy up to n of the most recent events, oldest first, into events.
+// Returns the number of events copied.
+size_t sco_record_get(uint64_t *events, size_t n);
+
+// Stop recording and free the ring buffer.
+void sco_record_stop(void);
+
+// Replay a recording on the calling thread. Whenever the scheduler picks
+// the next coroutine to run, it takes the one that the log switched to,
+// as long as it's scheduled. Timers and inbox messages are also handled at
+// the point of the log where they were recorded, so a sleep can end early,
+// or a message can wait, to keep the order. A timer that is more than
+// SCO_REPLAY_SLACK (1 second) late fires anyway. Every event is checked
+// against the log, and the replay ends at the first one that differs, after
+// which scheduling is back to normal. Coroutine ids are part of the events,
+// so the program must start the same coroutines in the same order as in the
+// recording. The events array must stay valid until the replay ends.
+// Returns false if n is zero or already recording or replaying.
+bool sco_replay_start(const uint64_t *events, size_t n);
+
+// Returns true while a replay is running and has matched every event.
+bool sco_replaying(void);
+
+// End the replay. Returns the number of events that were matched.
+size_t sco_replay_stop(void);
+
+// Coroutine states, as reported by sco_dump()
+#define SCO_STATE_RUNNING   1 // the current coroutine
+#define SCO_STATE_SCHEDULED 2 // started, yielded or resumed, and waiting to run
+#define SCO_STATE_PAUSED    3 // sco_pause()
+#define SCO_STATE_SLEEPING  4 // sco_sleep() or sco_sleep_until()
+#define SCO_STATE_WAITING   5 // sco_wait_fd() or another resume handle
+#define SCO_STATE_BLOCKED   6 // a wait queue, mutex, semaphore or channel
+
+// Position of a dump. Zero it to start at the beginning.
+struct sco_dump_iter {
+    int phase;
+    size_t pos;
+    int64_t last;
+};
+
+struct sco_dump_info {
+    int64_t id;
+    int state;            // SCO_STATE_*
+    int priority;         // SCO_PRIO_*
+    void *udata;          // User data from the sco_desc
+    void *stack;          // Lowest address of the stack
+    size_t stack_size;    // Size of the stack
+};
+
+// Fill infos with up to n of the calling thread's coroutines, continuing
+// from where the previous call with the same iterator stopped, so a large
+// dump can be taken a batch at a time between runloop steps. A batch takes
+// time in proportion to n, no matter how far along the dump is, as long as
+// one iterator is used at a time. Coroutines that change state between
+// batches may be missed or seen twice. The
+// coroutines that are queued for the worker pool are not included, since
+// they can be stolen at any time, and neither are the detached ones.
+// Returns the number of infos filled, which is zero when done.
+size_t sco_dump(struct sco_dump_iter *iter, struct sco_dump_info *infos,
+    size_t n);
+
+#define SCO_STACKSIG_DEPTH 24 // Most frames in a stack signature
+
+// A group of coroutines with the same stack
+struct sco_stack_sig {
+    uint64_t hash;        // Hash of the frames, zero if not unwound
+    size_t count;         // Number of coroutines in the group
+    int64_t id;           // The first coroutine in the group
+    int nips;             // Number of frames
+    void *ips[SCO_STACKSIG_DEPTH]; // Return addresses, see sco_symbolize()
+};
+
+// Unwind up to n of the calling thread's coroutines, in the same order as
+// sco_dump(), and count each in the sigs group that has the same stack.
+// The sigs array holds up to cap groups and nsigs is the number of groups
+// in use, which should start at zero. Coroutines with a new stack are not
+// counted once the array is full. The running coroutine, and those whose
+// context cannot be unwound, see sco_unwind_ips(), are grouped with a zero
+// hash. Returns the number of coroutines visited, which is zero when done.
+size_t sco_dump_stacks(struct sco_dump_iter *iter, size_t n,
+    struct sco_stack_sig *sigs, size_t *nsigs, size_t cap);
+
 #endif // SCO_H
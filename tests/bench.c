@@ -0,0 +1,436 @@
+// Scheduler benchmarks.
+//
+//   ./run.sh bench [csv] [<name>...]
+//
+// Each benchmark prints its name, the number of operations, and the average
+// nanoseconds per operation. With the "csv" argument the output is one
+// comma-separated line per benchmark, including the coroutine method, which
+// can be collected from different builds to compare them between commits.
+// A name selects the benchmark of exactly that name, and a name ending in
+// '*' selects every benchmark it prefixes, such as "runq_*".
+//
+// The largest pause_resume and runq benchmarks keep 100000 coroutines on
+// 16 KB stacks, which takes about 400 MB of resident memory while they run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "../sco.h"
+
+#define SMALL_STACK 16384 // for benchmarks that keep many coroutines paused
+
+static bool csv = false;
+static int nnames = 0;
+static char *names[64];
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*INT64_C(1000000000) + ts.tv_nsec;
+}
+
+static bool selected(const char *name) {
+    if (nnames == 0) {
+        return true;
+    }
+    for (int i = 0; i < nnames; i++) {
+        size_t len = strlen(names[i]);
+        if (len > 0 && names[i][len-1] == '*') {
+            if (strncmp(name, names[i], len-1) == 0) {
+                return true;
+            }
+        } else if (strcmp(name, names[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void report(const char *name, int threads, int64_t ops,
+    int64_t elapsed)
+{
+    double nsop = (double)elapsed/(double)ops;
+    if (csv) {
+        printf("%s,\"%s\",%d,%" PRId64 ",%.2f\n", name, sco_info_method(),
+            threads, ops, nsop);
+    } else {
+        printf("%-24s %2d thread%s %10" PRId64 " ops %10.2f ns/op\n", name,
+            threads, threads == 1 ? " " : "s", ops, nsop);
+    }
+    fflush(stdout);
+}
+
+static void runloop(void) {
+    while (sco_active()) {
+        sco_resume(0);
+    }
+}
+
+static void start_pooled(void(*entry)(void*), void *udata) {
+    sco_start_pooled(&(struct sco_desc){
+        .entry = entry,
+        .udata = udata,
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// yield: two coroutines switching back and forth with sco_yield()
+////////////////////////////////////////////////////////////////////////////////
+
+#define YIELD_N 1000000
+
+static void yield_entry(void *udata) {
+    (void)udata;
+    for (int i = 0; i < YIELD_N; i++) {
+        sco_yield();
+    }
+}
+
+static void yield_starter(void *udata) {
+    (void)udata;
+    start_pooled(yield_entry, 0);
+    start_pooled(yield_entry, 0);
+}
+
+static void bench_yield(void) {
+    int64_t start = now();
+    start_pooled(yield_starter, 0);
+    runloop();
+    report("yield", 1, YIELD_N*2, now()-start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// start: sco_start() plus exit of an empty coroutine
+////////////////////////////////////////////////////////////////////////////////
+
+#define START_N 1000000
+
+static void empty_entry(void *udata) {
+    (void)udata;
+}
+
+static void free_cleanup(void *stack, size_t stack_size, void *udata) {
+    (void)stack_size; (void)udata;
+    free(stack);
+}
+
+static void bench_start(void) {
+    int64_t start = now();
+    for (int i = 0; i < START_N; i++) {
+        void *stack = malloc(SCO_MINSTACKSIZE);
+        assert(stack);
+        sco_start(&(struct sco_desc){
+            .stack = stack,
+            .stack_size = SCO_MINSTACKSIZE,
+            .entry = empty_entry,
+            .cleanup = free_cleanup,
+        });
+    }
+    runloop();
+    report("start", 1, START_N, now()-start);
+}
+
+static void bench_start_pooled(void) {
+    int64_t start = now();
+    for (int i = 0; i < START_N; i++) {
+        start_pooled(empty_entry, 0);
+    }
+    runloop();
+    report("start_pooled", 1, START_N, now()-start);
+    sco_stack_trim();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pause_resume: resume one of many paused coroutines and let it pause again
+////////////////////////////////////////////////////////////////////////////////
+
+#define PAUSE_OPS 1000000
+
+struct pause_ctx {
+    int64_t npaused;
+    int64_t nstarted;
+    int64_t *ids;
+    char *stacks;
+    bool stop;
+    int64_t elapsed;
+};
+
+static void pause_entry(void *udata) {
+    struct pause_ctx *ctx = udata;
+    ctx->ids[ctx->nstarted++] = sco_id();
+    while (!ctx->stop) {
+        sco_pause();
+    }
+}
+
+static void pause_driver(void *udata) {
+    struct pause_ctx *ctx = udata;
+    for (int64_t i = 0; i < ctx->npaused; i++) {
+        sco_start(&(struct sco_desc){
+            .stack = ctx->stacks+i*SMALL_STACK,
+            .stack_size = SMALL_STACK,
+            .entry = pause_entry,
+            .udata = ctx,
+        });
+    }
+    assert((int64_t)sco_info_paused() == ctx->npaused);
+    // Visit the paused coroutines with a large odd stride, so that their
+    // lookups don't follow the order they were paused in.
+    int64_t j = 0;
+    int64_t stride = ctx->npaused > 1 ? 1000003 % ctx->npaused | 1 : 1;
+    int64_t start = now();
+    for (int64_t i = 0; i < PAUSE_OPS; i++) {
+        sco_resume(ctx->ids[j]);
+        sco_yield();
+        j = (j+stride) % ctx->npaused;
+    }
+    ctx->elapsed = now()-start;
+    ctx->stop = true;
+    for (int64_t i = 0; i < ctx->npaused; i++) {
+        sco_resume(ctx->ids[i]);
+    }
+}
+
+static void bench_pause_resume(int64_t npaused) {
+    char name[64];
+    snprintf(name, sizeof(name), "pause_resume_%" PRId64, npaused);
+    if (!selected(name)) {
+        return;
+    }
+    size_t len = (size_t)npaused*SMALL_STACK;
+    struct pause_ctx ctx = { .npaused = npaused };
+    ctx.ids = malloc(sizeof(int64_t)*npaused);
+    ctx.stacks = mmap(0, len, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    assert(ctx.ids && ctx.stacks != MAP_FAILED);
+    start_pooled(pause_driver, &ctx);
+    runloop();
+    report(name, 1, PAUSE_OPS, ctx.elapsed);
+    munmap(ctx.stacks, len);
+    free(ctx.ids);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// runq: many runnable coroutines taking turns with sco_yield()
+////////////////////////////////////////////////////////////////////////////////
+
+#define RUNQ_OPS 2000000
+
+struct runq_ctx {
+    int64_t nrunnable;
+    char *stacks;
+    int64_t ops;
+    bool stop;
+    int64_t elapsed;
+};
+
+static void runq_entry(void *udata) {
+    struct runq_ctx *ctx = udata;
+    while (!ctx->stop) {
+        sco_yield();
+        ctx->ops++;
+    }
+}
+
+static void runq_driver(void *udata) {
+    struct runq_ctx *ctx = udata;
+    for (int64_t i = 0; i < ctx->nrunnable; i++) {
+        sco_start(&(struct sco_desc){
+            .stack = ctx->stacks+i*SMALL_STACK,
+            .stack_size = SMALL_STACK,
+            .entry = runq_entry,
+            .udata = ctx,
+        });
+    }
+    // Let every coroutine get going before measuring.
+    sco_yield();
+    ctx->ops = 0;
+    int64_t start = now();
+    while (ctx->ops < RUNQ_OPS) {
+        sco_yield();
+    }
+    ctx->elapsed = now()-start;
+    ctx->stop = true;
+}
+
+static void bench_runq(int64_t nrunnable) {
+    char name[64];
+    snprintf(name, sizeof(name), "runq_%" PRId64, nrunnable);
+    if (!selected(name)) {
+        return;
+    }
+    size_t len = (size_t)nrunnable*SMALL_STACK;
+    struct runq_ctx ctx = { .nrunnable = nrunnable };
+    ctx.stacks = mmap(0, len, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    assert(ctx.stacks != MAP_FAILED);
+    start_pooled(runq_driver, &ctx);
+    runloop();
+    report(name, 1, ctx.ops, ctx.elapsed);
+    munmap(ctx.stacks, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detach_attach: every thread detaches and reattaches its own coroutine
+////////////////////////////////////////////////////////////////////////////////
+
+#define DETACH_N 200000
+
+static atomic_int detach_ready;
+static atomic_bool detach_go;
+
+static __thread int64_t detach_id;
+
+static void detach_entry(void *udata) {
+    (void)udata;
+    detach_id = sco_id();
+    sco_pause();
+}
+
+static void detach_driver(void *udata) {
+    (void)udata;
+    start_pooled(detach_entry, 0);
+    int64_t id = detach_id;
+    atomic_fetch_add(&detach_ready, 1);
+    while (!atomic_load(&detach_go)) {
+        sco_yield();
+    }
+    for (int i = 0; i < DETACH_N; i++) {
+        sco_detach(id);
+        sco_attach(id);
+    }
+    sco_resume(id);
+}
+
+static void *detach_thread(void *arg) {
+    (void)arg;
+    start_pooled(detach_driver, 0);
+    runloop();
+    sco_stack_trim();
+    return 0;
+}
+
+static void bench_detach_attach(int nthreads) {
+    if (!selected("detach_attach")) {
+        return;
+    }
+    pthread_t threads[64];
+    atomic_store(&detach_ready, 0);
+    atomic_store(&detach_go, false);
+    for (int i = 0; i < nthreads; i++) {
+        int ret = pthread_create(&threads[i], 0, detach_thread, 0);
+        assert(ret == 0);
+        (void)ret;
+    }
+    while (atomic_load(&detach_ready) < nthreads) {
+        sched_yield();
+    }
+    int64_t start = now();
+    atomic_store(&detach_go, true);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], 0);
+    }
+    // Every thread does DETACH_N detach and attach pairs.
+    report("detach_attach", nthreads, (int64_t)DETACH_N*nthreads, 
+        now()-start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// migrate: detach many paused coroutines and attach them again, one id at a
+// time with sco_detach() and sco_attach(), or all at once with a batch
+////////////////////////////////////////////////////////////////////////////////
+
+#define MIGRATE_N 50000
+
+static void bench_migrate(bool batched) {
+    const char *name = batched ? "migrate_many" : "migrate_each";
+    if (!selected(name)) {
+        return;
+    }
+    size_t len = (size_t)MIGRATE_N*SMALL_STACK;
+    struct pause_ctx ctx = { .npaused = MIGRATE_N };
+    ctx.ids = malloc(sizeof(int64_t)*MIGRATE_N);
+    ctx.stacks = mmap(0, len, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    assert(ctx.ids && ctx.stacks != MAP_FAILED);
+    for (int64_t i = 0; i < MIGRATE_N; i++) {
+        sco_start(&(struct sco_desc){
+            .stack = ctx.stacks+i*SMALL_STACK,
+            .stack_size = SMALL_STACK,
+            .entry = pause_entry,
+            .udata = &ctx,
+        });
+    }
+    int64_t start = now();
+    if (batched) {
+        struct sco_batch batch = { 0 };
+        sco_detach_many(ctx.ids, MIGRATE_N, &batch);
+        sco_attach_many(&batch);
+    } else {
+        for (int64_t i = 0; i < MIGRATE_N; i++) {
+            sco_detach(ctx.ids[i]);
+        }
+        for (int64_t i = 0; i < MIGRATE_N; i++) {
+            sco_attach(ctx.ids[i]);
+        }
+    }
+    int64_t elapsed = now()-start;
+    assert(sco_info_paused() == MIGRATE_N);
+    ctx.stop = true;
+    for (int64_t i = 0; i < MIGRATE_N; i++) {
+        sco_resume(ctx.ids[i]);
+    }
+    runloop();
+    report(name, 1, MIGRATE_N, elapsed);
+    munmap(ctx.stacks, len);
+    free(ctx.ids);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "bench") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "csv") == 0) {
+            csv = true;
+        } else {
+            assert(nnames < 64);
+            names[nnames++] = argv[i];
+        }
+    }
+    if (csv) {
+        printf("name,method,threads,ops,ns_per_op\n");
+    } else {
+        printf("method: %s\n", sco_info_method());
+    }
+    if (selected("yield")) {
+        bench_yield();
+    }
+    if (selected("start")) {
+        bench_start();
+    }
+    if (selected("start_pooled")) {
+        bench_start_pooled();
+    }
+    bench_pause_resume(1000);
+    bench_pause_resume(10000);
+    bench_pause_resume(100000);
+    bench_runq(1000);
+    bench_runq(10000);
+    bench_runq(100000);
+    bench_migrate(false);
+    bench_migrate(true);
+    bench_detach_attach(1);
+    bench_detach_attach(2);
+    bench_detach_attach(4);
+    bench_detach_attach(8);
+    return 0;
+}
@@ -18,7 +18,7 @@ finish() {
 trap finish EXIT
 
 # Use address sanitizer if possible
-if [[ "$1" != "bench" ]]; then
+if [[ "$1" != "bench" && "$1" != "stress" ]]; then
     CFLAGS="-O0 -g3 -Wall -Wextra -fstrict-aliasing $CFLAGS"
     if [[ "$VALGRIND" != "1" && ("$CC" == "" || "$CC" == "clang") && \
           "`which clang`" != "" ]]; \
@@ -46,6 +46,8 @@ if [[ "$1" != "bench" ]]; then
         fi
     fi
     CFLAGS=${CFLAGS:-"-O0 -g3 -Wall -Wextra -fstrict-aliasing"}
+elif [[ "$1" == "stress" ]]; then
+    CFLAGS=${CFLAGS:-"-O3 -DSCO_STATS"}
 else
     CFLAGS=${CFLAGS:-"-O3"}
 fi
@@ -59,13 +61,22 @@ if [[ "$CC" == "emcc" ]]; then
 fi
 
 CC=${CC:-cc}
+if [[ "$CC" != "emcc" ]]; then
+    # The sco_set_quantum() ticker is a thread.
+    LIBS="-lpthread"
+fi
 echo "CC: $CC"
 echo "CFLAGS: $CFLAGS"
 $CC --version
 if [[ "$1" == "bench" ]]; then
     echo "BENCHMARKING..."
-    echo $CC $CFLAGS ../sco.c bench.c
-    $CC $CFLAGS ../sco.c bench.c
+    echo $CC $CFLAGS ../sco.c bench.c $LIBS
+    $CC $CFLAGS ../sco.c bench.c $LIBS
+    ./a.out $@
+elif [[ "$1" == "stress" ]]; then
+    echo "STRESSING..."
+    echo $CC $CFLAGS ../sco.c stress.c $LIBS
+    $CC $CFLAGS ../sco.c stress.c $LIBS
     ./a.out $@
 else
     echo "TESTING..."
@@ -82,7 +93,7 @@ else
             fi 
             if [[ "$f" != $p* ]]; then continue; fi
         fi
-        $CC $CFLAGS -DSCO_NOAMALGA -o $f.test ../sco.c ../deps/llco.c $f
+        $CC $CFLAGS -DSCO_NOAMALGA -o $f.test ../sco.c ../deps/llco.c $f $LIBS
         if [[ "$WITHCOV" == "1" ]]; then
             MallocNanoZone=0 LLVM_PROFILE_FILE="$f.profraw" ./$f.test $@
         elif [[ "$CC" == "emcc" ]]; then
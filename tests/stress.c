@@ -0,0 +1,416 @@
+// Stress and scaling harness for moving coroutines between threads.
+//
+//   ./run.sh stress [csv] [rss] [threads=<n,...>] [coroutines=<n,...>]
+//                   [migrate=<percent>] [batch=<n>] [ms=<n>]
+//
+// For every combination of thread and coroutine counts, the coroutines are
+// split evenly over the threads and paused. Each thread then keeps picking
+// one of the coroutines it owns and either resumes it, which makes it run and
+// pause again, or moves it to another thread. A move detaches the coroutine
+// and posts it to the other thread's inbox, which attaches and resumes it.
+// With batch=<n> a move takes up to n coroutines with sco_detach_many() and
+// the other thread attaches them all with sco_attach_many().
+//
+// Each run prints the operations per second over all threads, the number of
+// coroutines moved, the time spent waiting for the locks of the detached
+// store (needs SCO_STATS, which run.sh defines by default), and the resident
+// memory at the start, the peak, and the end of the run. With "rss" it also
+// prints the resident memory every 100 ms.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../sco.h"
+
+#define SMALL_STACK 16384
+#define MAXTHREADS 64
+#define MAXBATCH 1024
+#define MAILBOX 16 // batches waiting for one thread
+
+static bool csv = false;
+static bool rss_series = false;
+static int migrate = 10;
+static int batch = 0;
+static int64_t run_ms = 1000;
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*INT64_C(1000000000) + ts.tv_nsec;
+}
+
+static size_t rss(void) {
+    size_t pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*s %zu", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages*(size_t)sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Batches are handed to the other thread under a mutex, because a batch
+// must be attached after sco_detach_many() has returned.
+struct mail {
+    struct sco_batch batch;
+    size_t n;
+    int64_t ids[MAXBATCH];
+};
+
+struct worker {
+    int index;
+    pthread_t th;
+    struct sco_inbox *inbox;
+    pthread_mutex_t mu;
+    size_t nmail;
+    struct mail mail[MAILBOX];
+    int64_t *ids; // coroutines owned by this thread
+    size_t nids;
+    size_t cap;
+    char *stacks;
+    size_t nstacks;
+    int64_t ops;
+    int64_t moves;
+    struct sco_stats stats;
+    bool has_stats;
+};
+
+static struct worker workers[MAXTHREADS];
+static int nworkers;
+static atomic_int phase; // 0: starting, 1: running, 2: draining, 3: finishing
+static atomic_int nready;
+static atomic_int_fast64_t inflight; // moved coroutines that are not owned yet
+static __thread struct worker *self;
+
+static void own(struct worker *w, int64_t id) {
+    if (w->nids == w->cap) {
+        w->cap = w->cap ? w->cap*2 : 1024;
+        w->ids = realloc(w->ids, w->cap*sizeof(int64_t));
+        assert(w->ids);
+    }
+    w->ids[w->nids++] = id;
+}
+
+// A coroutine owns up to the thread it wakes up on after a move.
+static void co_entry(void *udata) {
+    struct worker *owner = udata;
+    own(owner, sco_id());
+    while (1) {
+        sco_pause();
+        if (atomic_load(&phase) == 3) {
+            break;
+        }
+        if (owner != self) {
+            owner = self;
+            own(owner, sco_id());
+            atomic_fetch_sub(&inflight, 1);
+        }
+    }
+}
+
+// Wait for all threads to reach the same step, while still handling the
+// inbox.
+static void sync_step(int step) {
+    atomic_fetch_add(&nready, 1);
+    while (atomic_load(&nready) < nworkers*step) {
+        sco_resume(0);
+        sched_yield();
+    }
+}
+
+static void recv_mail(struct worker *w) {
+    pthread_mutex_lock(&w->mu);
+    for (size_t i = 0; i < w->nmail; i++) {
+        struct mail *m = &w->mail[i];
+        sco_attach_many(&m->batch);
+        sco_resume_many_noyield(m->ids, m->n);
+    }
+    w->nmail = 0;
+    pthread_mutex_unlock(&w->mu);
+}
+
+static void move_one(struct worker *w, size_t i, struct worker *to) {
+    int64_t id = w->ids[i];
+    w->ids[i] = w->ids[--w->nids];
+    atomic_fetch_add(&inflight, 1);
+    sco_detach(id);
+    if (!sco_post_adopt(to->inbox, id)) {
+        // The inbox is full. Keep it.
+        sco_attach(id);
+        own(w, id);
+        atomic_fetch_sub(&inflight, 1);
+        return;
+    }
+    w->moves++;
+}
+
+static void move_many(struct worker *w, size_t i, struct worker *to) {
+    pthread_mutex_lock(&to->mu);
+    if (to->nmail == MAILBOX) {
+        pthread_mutex_unlock(&to->mu);
+        return;
+    }
+    struct mail *m = &to->mail[to->nmail++];
+    m->n = 0;
+    while (m->n < (size_t)batch && w->nids > 0) {
+        i %= w->nids;
+        m->ids[m->n++] = w->ids[i];
+        w->ids[i] = w->ids[--w->nids];
+    }
+    atomic_fetch_add(&inflight, (int64_t)m->n);
+    size_t n = sco_detach_many(m->ids, m->n, &m->batch);
+    assert(n == m->n);
+    (void)n;
+    pthread_mutex_unlock(&to->mu);
+    w->moves += (int64_t)m->n;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    self = w;
+    w->inbox = sco_inbox_open();
+    assert(w->inbox);
+    for (size_t i = 0; i < w->nstacks; i++) {
+        sco_start(&(struct sco_desc){
+            .stack = w->stacks+i*SMALL_STACK,
+            .stack_size = SMALL_STACK,
+            .entry = co_entry,
+            .udata = w,
+        });
+    }
+    struct sco_stats start;
+    sco_stats_get(&start);
+    sync_step(1);
+    while (atomic_load(&phase) == 0) {
+        sched_yield();
+    }
+    uint64_t rng = (uint64_t)(w->index+1)*UINT64_C(0x9e3779b97f4a7c15);
+    while (atomic_load(&phase) == 1) {
+        if (w->nids > 0) {
+            uint64_t r = xorshift(&rng);
+            size_t i = (size_t)(r % w->nids);
+            if (nworkers > 1 && (int)((r >> 32) % 100) < migrate) {
+                int off = 1+(int)((r >> 40) % (uint64_t)(nworkers-1));
+                struct worker *to = &workers[(w->index+off)%nworkers];
+                if (batch > 0) {
+                    move_many(w, i, to);
+                } else {
+                    move_one(w, i, to);
+                }
+            } else {
+                sco_resume(w->ids[i]);
+            }
+            w->ops++;
+        }
+        if (batch > 0 && w->nmail > 0) {
+            recv_mail(w);
+        }
+        sco_resume(0);
+    }
+    // Nothing moves anymore. Handle what is still on the way.
+    sync_step(2);
+    while (atomic_load(&inflight) > 0) {
+        recv_mail(w);
+        sco_resume(0);
+        sched_yield();
+    }
+    w->has_stats = sco_stats_get(&w->stats);
+    w->stats.lock_waits -= start.lock_waits;
+    w->stats.lock_wait_ns -= start.lock_wait_ns;
+    sync_step(3);
+    while (atomic_load(&phase) != 3) {
+        sched_yield();
+    }
+    sco_resume_many_noyield(w->ids, w->nids);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    sco_inbox_close();
+    return NULL;
+}
+
+static void run(int nthreads, int64_t ncos) {
+    size_t rss_start = rss();
+    size_t rss_peak = rss_start;
+    nworkers = nthreads;
+    atomic_store(&phase, 0);
+    atomic_store(&nready, 0);
+    atomic_store(&inflight, 0);
+    for (int i = 0; i < nthreads; i++) {
+        struct worker *w = &workers[i];
+        memset(w, 0, sizeof(struct worker));
+        w->index = i;
+        pthread_mutex_init(&w->mu, NULL);
+        w->nstacks = (size_t)(ncos/nthreads + (i < ncos%nthreads));
+        if (w->nstacks > 0) {
+            w->stacks = mmap(0, w->nstacks*SMALL_STACK, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+            assert(w->stacks != MAP_FAILED);
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        int ret = pthread_create(&workers[i].th, 0, worker_main, &workers[i]);
+        assert(ret == 0);
+        (void)ret;
+    }
+    while (atomic_load(&nready) < nthreads) {
+        usleep(1000);
+    }
+    int64_t start = now();
+    int64_t next = start;
+    atomic_store(&phase, 1);
+    while (1) {
+        int64_t elapsed = now()-start;
+        if (elapsed >= run_ms*1000000) {
+            break;
+        }
+        size_t r = rss();
+        rss_peak = r > rss_peak ? r : rss_peak;
+        if (rss_series && now() >= next) {
+            printf("rss,%d,%" PRId64 ",%" PRId64 ",%zu\n", nthreads, ncos,
+                elapsed/1000000, r);
+            next += 100000000;
+        }
+        usleep(10000);
+    }
+    atomic_store(&phase, 2);
+    int64_t elapsed = now()-start;
+    while (atomic_load(&nready) < nthreads*3) {
+        usleep(1000);
+    }
+    int64_t ops = 0;
+    int64_t moves = 0;
+    int64_t owned = 0;
+    uint64_t lock_waits = 0;
+    uint64_t lock_wait_ns = 0;
+    bool has_stats = true;
+    for (int i = 0; i < nthreads; i++) {
+        struct worker *w = &workers[i];
+        ops += w->ops;
+        moves += w->moves;
+        owned += (int64_t)w->nids;
+        lock_waits += w->stats.lock_waits;
+        lock_wait_ns += w->stats.lock_wait_ns;
+        has_stats = has_stats && w->has_stats;
+    }
+    // Every coroutine is owned by exactly one thread.
+    assert(owned == ncos);
+    atomic_store(&phase, 3);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].th, 0);
+    }
+    size_t rss_end = rss();
+    for (int i = 0; i < nthreads; i++) {
+        struct worker *w = &workers[i];
+        if (w->stacks) {
+            munmap(w->stacks, w->nstacks*SMALL_STACK);
+        }
+        free(w->ids);
+        pthread_mutex_destroy(&w->mu);
+    }
+    double opsec = (double)ops/((double)elapsed/1e9);
+    char waits[64] = "-";
+    char wait_ms[64] = "-";
+    if (has_stats) {
+        snprintf(waits, sizeof(waits), "%" PRIu64, lock_waits);
+        snprintf(wait_ms, sizeof(wait_ms), "%.3f", lock_wait_ns/1e6);
+    }
+    if (csv) {
+        printf("\"%s\",%d,%" PRId64 ",%d,%d,%.0f,%" PRId64 ",%s,%s,"
+            "%zu,%zu,%zu\n",
+            sco_info_method(), nthreads, ncos, migrate, batch, opsec, moves,
+            waits, wait_ms, rss_start, rss_peak, rss_end);
+    } else {
+        printf("threads %-3d coroutines %-8" PRId64 " %12.0f ops/sec "
+            "%10" PRId64 " moves %10s lock waits %10s ms "
+            "rss %zu/%zu/%zu MB\n", nthreads, ncos, opsec, moves, waits,
+            wait_ms, rss_start>>20, rss_peak>>20, rss_end>>20);
+    }
+    fflush(stdout);
+}
+
+static int parse_list(const char *s, int64_t *vals, int max) {
+    int n = 0;
+    while (*s && n < max) {
+        char *end;
+        vals[n++] = strtoll(s, &end, 10);
+        s = *end == ',' ? end+1 : end;
+        if (s == end && *s) {
+            break;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int64_t threads[16] = { 1, 2, 4, 8, 16, 32, 64 };
+    int nthreads = 7;
+    int64_t cos[16] = { 1000, 10000, 100000, 1000000 };
+    int ncos = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "stress") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "rss") == 0) {
+            rss_series = true;
+        } else if (strncmp(argv[i], "threads=", 8) == 0) {
+            nthreads = parse_list(argv[i]+8, threads, 16);
+        } else if (strncmp(argv[i], "coroutines=", 11) == 0) {
+            ncos = parse_list(argv[i]+11, cos, 16);
+        } else if (strncmp(argv[i], "migrate=", 8) == 0) {
+            migrate = atoi(argv[i]+8);
+        } else if (strncmp(argv[i], "batch=", 6) == 0) {
+            batch = atoi(argv[i]+6);
+        } else if (strncmp(argv[i], "ms=", 3) == 0) {
+            run_ms = atoll(argv[i]+3);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (batch < 0 || batch > MAXBATCH) {
+        fprintf(stderr, "batch must be 0 to %d\n", MAXBATCH);
+        return 1;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i] < 1 || threads[i] > MAXTHREADS) {
+            fprintf(stderr, "threads must be 1 to %d\n", MAXTHREADS);
+            return 1;
+        }
+    }
+    if (csv) {
+        printf("method,threads,coroutines,migrate,batch,ops_per_sec,moves,"
+            "lock_waits,lock_wait_ms,rss_start,rss_peak,rss_end\n");
+    } else {
+        printf("method: %s, migrate: %d%%, batch: %d, run: %" PRId64 " ms\n",
+            sco_info_method(), migrate, batch, run_ms);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        for (int j = 0; j < ncos; j++) {
+            run((int)threads[i], cos[j]);
+        }
+    }
+    return 0;
+}
@@ -38,7 +38,7 @@ void test_sco_start(void) {
 
 void co_sleep(void *udata) {
     assert(*(int*)udata == 99999999);
-    sco_sleep(1e8); // 100ms cpu-based sleep
+    cpu_sleep(1e8); // 100ms cpu-based sleep
 }
 
 void test_sco_sleep(void) {
@@ -72,7 +72,7 @@ void co_pause_one(void *udata) {
     }
 
     // pause in reverse
-    sco_sleep(1e6 * (NCHILDREN-index));
+    cpu_sleep(1e6 * (NCHILDREN-index));
     npaused++;
     is_paused[index] = true;
     sco_pause();
@@ -94,7 +94,7 @@ void co_pause_one(void *udata) {
     }
 
     // pause in reverse, again
-    sco_sleep(1e6 * (NCHILDREN-index));
+    cpu_sleep(1e6 * (NCHILDREN-index));
     npaused++;
     is_paused[index] = true;
     sco_pause();
@@ -188,7 +188,7 @@ void co_thread_one(void *udata) {
     int index = *(int*)udata;
     int64_t id = sco_id();
     thpaused[index] = id;
-    sco_sleep(1e6);
+    cpu_sleep(1e6);
     sco_pause();
 }
 
@@ -208,6 +208,7 @@ void *thread0(void *arg) {
         }
         sco_resume(0);
     }
+    assert(sco_thread_cleanup());
     return NULL;
 }
 
@@ -225,6 +226,7 @@ void *thread1(void *arg) {
     while (sco_active()) {
         sco_resume(0);
     }
+    assert(sco_thread_cleanup());
     return NULL;
 }
 
@@ -236,19 +238,1251 @@ void test_sco_detach(void) {
     assert(pthread_join(th1, 0) == 0);
 }
 
+static int64_t batch_ids[NCHILDREN+1];
+static int nbatch_done = 0;
+
+void co_batch_one(void *udata) {
+    int index = *(int*)udata;
+    batch_ids[index] = sco_id();
+    if (index == 0) {
+        // Long enough not to expire while the batch is moved, and woken
+        // early by batch_thread.
+        sco_sleep(INT64_C(10000000000));
+    } else {
+        sco_pause();
+    }
+    nbatch_done++;
+}
+
+void *batch_thread(void *arg) {
+    struct sco_batch *batch = arg;
+    reset_stats();
+    assert(sco_attach_many(batch) == NCHILDREN);
+    assert(batch->count == 0 && !batch->head);
+    assert(sco_info_paused() == NCHILDREN);
+    assert(sco_info_sleeping() == 1);
+    for (int i = 0; i < NCHILDREN; i++) {
+        sco_resume(batch_ids[i]);
+    }
+    assert(sco_info_sleeping() == 0);
+    assert(!sco_thread_cleanup());
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sco_thread_cleanup());
+    return NULL;
+}
+
+void test_sco_detach_many(void) {
+    reset_stats();
+    nbatch_done = 0;
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_batch_one, co_cleanup, &i);
+    }
+    assert(sco_info_paused() == NCHILDREN);
+    struct sco_batch batch = { 0 };
+    // The last id is not a paused coroutine.
+    batch_ids[NCHILDREN] = batch_ids[NCHILDREN-1]+1000;
+    assert(sco_detach_many(batch_ids, 2, &batch) == 2);
+    assert(sco_detach_many(batch_ids+2, NCHILDREN-1, &batch) == NCHILDREN-2);
+    assert(batch.count == NCHILDREN);
+    assert(sco_info_paused() == 0 && sco_info_sleeping() == 0);
+    assert(sco_info_detached() == NCHILDREN);
+    assert(!sco_active());
+    pthread_t th;
+    assert(pthread_create(&th, 0, batch_thread, &batch) == 0);
+    assert(pthread_join(th, 0) == 0);
+    assert(nbatch_done == NCHILDREN);
+    assert(sco_info_detached() == 0);
+}
+
+static int64_t inbox_ids[NCHILDREN];
+static int ninbox_ids = 0;
+static int ninbox_done = 0;
+
+void co_inbox_one(void *udata) {
+    (void)udata;
+    inbox_ids[ninbox_ids++] = sco_id();
+    sco_pause();
+    ninbox_done++;
+}
+
+void co_inbox_adoptee(void *udata) {
+    *(int64_t*)udata = sco_id();
+    sco_pause();
+    // Now running on the thread that adopted this coroutine.
+    ninbox_done++;
+}
+
+void *inbox_poster(void *arg) {
+    struct sco_inbox *inbox = arg;
+    reset_stats();
+    // Give the main thread time to block in sco_poll().
+    usleep(20000);
+    for (int i = 0; i < NCHILDREN; i++) {
+        assert(sco_post_resume(inbox, inbox_ids[i]));
+    }
+    int64_t id = 0;
+    quick_start(co_inbox_adoptee, co_cleanup, &id);
+    sco_detach(id);
+    assert(sco_post_adopt(inbox, id));
+    assert(sco_thread_cleanup());
+    return NULL;
+}
+
+void test_sco_inbox(void) {
+    reset_stats();
+    ninbox_ids = 0;
+    ninbox_done = 0;
+    struct sco_inbox *inbox = sco_inbox_open();
+    assert(inbox && sco_inbox_open() == inbox);
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_inbox_one, co_cleanup, 0);
+    }
+    assert(sco_info_paused() == NCHILDREN);
+    pthread_t th;
+    assert(pthread_create(&th, 0, inbox_poster, inbox) == 0);
+    while (ninbox_done < NCHILDREN+1) {
+        sco_poll(sco_info_scheduled() > 0 ? 0 : -1);
+        sco_resume(0);
+    }
+    assert(pthread_join(th, 0) == 0);
+    assert(!sco_active());
+    sco_inbox_close();
+}
+
+
+#define NPOOLTHREADS 4
+
+static atomic_bool pool_ready = false;
+static atomic_int pool_finished = 0;
+static __thread int pool_thread = 0;
+
+void co_pool_child(void *udata) {
+    for (int i = 0; i < 1000; i++) {
+        sco_yield();
+    }
+    atomic_fetch_add(&pool_finished, 1);
+    if (udata) {
+        // Leaving the pool through sco_exit() must end it just the same.
+        sco_exit();
+    }
+}
+
+void co_pool_root(void *udata) {
+    (void)udata;
+    // Nothing waits on a pool thread, and coroutines started from one don't
+    // join groups, since they could be stolen.
+    struct sco_mutex mu = { 0 };
+    assert(sco_mutex_lock(&mu));
+    assert(!sco_mutex_lock(&mu));
+    sco_mutex_unlock(&mu);
+    struct sco_sem sem = { 0 };
+    assert(!sco_sem_wait(&sem));
+    struct sco_group group = { 0 };
+    started++;
+    sco_start(&(struct sco_desc){
+        .stack = xmalloc(STACK_SIZE),
+        .stack_size = STACK_SIZE,
+        .entry = co_pool_child,
+        .cleanup = co_cleanup,
+        .group = &group,
+    });
+    assert(group.count == 0);
+    assert(!sco_group_wait(&group));
+    atomic_store(&pool_ready, true);
+    for (int i = 1; i < NCHILDREN; i++) {
+        quick_start(co_pool_child, co_cleanup, (void*)(intptr_t)(i&1));
+    }
+}
+
+void *pool_thread_entry(void *arg) {
+    pool_thread = (int)(intptr_t)arg;
+    assert(sco_pool_join());
+    if (pool_thread == 0) {
+        quick_start(co_pool_root, co_cleanup, 0);
+    } else {
+        while (!atomic_load(&pool_ready)) {
+            // Wait ...
+        }
+    }
+    while (sco_pool_active()) {
+        sco_resume(0);
+    }
+    sco_pool_leave();
+    assert(!sco_active());
+    assert(sco_thread_cleanup());
+    return NULL;
+}
+
+void test_sco_pool(void) {
+    pthread_t ths[NPOOLTHREADS];
+    for (int i = 0; i < NPOOLTHREADS; i++) {
+        assert(pthread_create(&ths[i], 0, pool_thread_entry, 
+            (void*)(intptr_t)i) == 0);
+    }
+    for (int i = 0; i < NPOOLTHREADS; i++) {
+        assert(pthread_join(ths[i], 0) == 0);
+    }
+    assert(atomic_load(&pool_finished) == NCHILDREN);
+    assert(!sco_pool_active());
+}
+
+#ifndef SCO_NUMA_IMBALANCE
+#define SCO_NUMA_IMBALANCE 8
+#endif
+
+#define NUMA_NEAR 4
+#define NUMA_FAR 20
+
+static atomic_int numa_ready = 0;
+static atomic_bool numa_release = false;
+static atomic_int numa_done = 0;
+static char numa_order[NUMA_NEAR+NUMA_FAR+1];
+static int numa_thief_runs = 0;
+
+void co_numa_child(void *udata) {
+    sco_yield();
+    if (pool_thread == 2) {
+        // Running on the thief.
+        numa_order[numa_thief_runs++] = (char)(intptr_t)udata;
+    }
+    atomic_fetch_add(&numa_done, 1);
+}
+
+// Fill the thread's deque with yielded children, then hold the thread so
+// that the thief is the only one taking them.
+void co_numa_victim(void *udata) {
+    int n = udata ? NUMA_FAR : NUMA_NEAR;
+    for (int i = 0; i < n; i++) {
+        quick_start(co_numa_child, co_cleanup, 
+            (void*)(intptr_t)(udata ? 'f' : 'n'));
+    }
+    atomic_fetch_add(&numa_ready, 1);
+    while (!atomic_load(&numa_release)) {
+        usleep(100);
+    }
+}
+
+void *numa_thread_entry(void *arg) {
+    pool_thread = (int)(intptr_t)arg;
+    assert(sco_pool_join());
+    // Thread 1 is on a node of its own.
+    sco_set_node(pool_thread == 1 ? 1 : 0);
+    if (pool_thread < 2) {
+        quick_start(co_numa_victim, co_cleanup, 
+            (void*)(intptr_t)pool_thread);
+    } else {
+        while (atomic_load(&numa_ready) < 2) {
+            usleep(100);
+        }
+        // The thief takes all of the coroutines on its own node first, but
+        // from the other node only while the backlog there is large.
+        int left = NUMA_FAR;
+        int nfar = 0;
+        while (left >= SCO_NUMA_IMBALANCE) {
+            nfar += (left+1)/2;
+            left -= (left+1)/2;
+        }
+        while (numa_thief_runs < NUMA_NEAR+nfar) {
+            sco_resume(0);
+        }
+        sco_resume(0);
+        assert(numa_thief_runs == NUMA_NEAR+nfar);
+        numa_order[numa_thief_runs] = '\0';
+        for (int i = 0; i < numa_thief_runs; i++) {
+            assert(numa_order[i] == (i < NUMA_NEAR ? 'n' : 'f'));
+        }
+        atomic_store(&numa_release, true);
+    }
+    while (sco_pool_active()) {
+        sco_resume(0);
+    }
+    sco_pool_leave();
+    assert(sco_thread_cleanup());
+    return NULL;
+}
+
+void test_sco_pool_numa(void) {
+    pthread_t ths[3];
+    for (int i = 0; i < 3; i++) {
+        assert(pthread_create(&ths[i], 0, numa_thread_entry, 
+            (void*)(intptr_t)i) == 0);
+    }
+    for (int i = 0; i < 3; i++) {
+        assert(pthread_join(ths[i], 0) == 0);
+    }
+    assert(atomic_load(&numa_done) == NUMA_NEAR+NUMA_FAR);
+    assert(!sco_pool_active());
+}
+
+static struct sco_handle handles[NCHILDREN];
+static int nhandled = 0;
+
+void co_handle_one(void *udata) {
+    int index = *(int*)udata;
+    handles[index] = sco_pause_handle();
+    assert(handles[index].co);
+    sco_pause();
+    nhandled++;
+}
+
+void co_handle_all(void *udata) {
+    (void)udata;
+    assert(sco_info_paused() == NCHILDREN);
+    // Handle paused coroutines are not resumable by id
+    sco_resume(sco_id()-1);
+    assert(sco_info_paused() == NCHILDREN);
+    // This yields, so the first child can run to completion and its handle
+    // must not be used again.
+    assert(sco_resume_handle(handles[0]));
+}
+
+void test_sco_handle(void) {
+    reset_stats();
+    nhandled = 0;
+    assert(sco_pause_handle().co == NULL);
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_handle_one, co_cleanup, &i);
+    }
+    quick_start(co_handle_all, co_cleanup, 0);
+    while (nhandled == 0) {
+        sco_resume(0);
+    }
+    assert(sco_info_paused() == NCHILDREN-1);
+    // From main the resumes don't yield, so each handle is seen going stale
+    // while its coroutine is still only scheduled.
+    for (int i = 1; i < NCHILDREN; i++) {
+        assert(sco_resume_handle(handles[i]));
+        assert(!sco_resume_handle(handles[i]));
+    }
+    assert(sco_info_paused() == 0);
+    assert(nhandled == 1);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nhandled == NCHILDREN);
+}
+
+static int64_t yt_consumer = 0;
+static int yt_busy = 0;
+static int yt_seen = -1;
+static bool yt_done = false;
+
+void co_yt_busy(void *udata) {
+    (void)udata;
+    while (!yt_done) {
+        yt_busy++;
+        sco_yield();
+    }
+}
+
+void co_yt_consumer(void *udata) {
+    (void)udata;
+    yt_consumer = sco_id();
+    while (!yt_done) {
+        sco_pause();
+        yt_seen = yt_busy;
+    }
+}
+
+void co_yt_producer(void *udata) {
+    (void)udata;
+    assert(!sco_yield_to(-1));
+    for (int i = 0; i < 10; i++) {
+        int busy = yt_busy;
+        yt_seen = -1;
+        assert(sco_yield_to(yt_consumer));
+        // The consumer ran before any of the busy coroutines.
+        assert(yt_seen == busy);
+        sco_yield();
+    }
+    yt_done = true;
+    sco_resume(yt_consumer);
+}
+
+void test_sco_yield_to(void) {
+    reset_stats();
+    yt_done = false;
+    assert(!sco_yield_to(1));
+    quick_start(co_yt_consumer, co_cleanup, 0);
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_yt_busy, co_cleanup, 0);
+    }
+    quick_start(co_yt_producer, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(yt_busy > 0);
+}
+
+static struct sco_mutex sync_mu;
+static struct sco_sem sync_sem;
+static struct sco_waitq sync_wq;
+static struct sco_chan sync_chan;
+static int sync_inside = 0;
+static int sync_maxinside = 0;
+static int sync_total = 0;
+
+void co_sync_mutex(void *udata) {
+    (void)udata;
+    for (int i = 0; i < 10; i++) {
+        assert(sco_mutex_lock(&sync_mu));
+        assert(++sync_inside == 1);
+        sco_yield();
+        assert(sco_info_paused() == sync_mu.waiters.count);
+        sync_maxinside = sync_mu.waiters.count > (size_t)sync_maxinside ? 
+            (int)sync_mu.waiters.count : sync_maxinside;
+        sync_inside--;
+        sco_mutex_unlock(&sync_mu);
+        sco_yield();
+    }
+}
+
+void co_sync_sem(void *udata) {
+    (void)udata;
+    assert(sco_sem_wait(&sync_sem));
+    sync_inside++;
+    sync_maxinside = sync_inside > sync_maxinside ? sync_inside:sync_maxinside;
+    sco_yield();
+    sync_inside--;
+    sco_sem_post(&sync_sem);
+}
+
+// Start the coroutines from a coroutine, so that they run at the same time.
+void co_sync_start(void *udata) {
+    for (int i = 0; i < 10; i++) {
+        quick_start(udata == &sync_mu ? co_sync_mutex : co_sync_sem, 
+            co_cleanup, 0);
+    }
+}
+
+void co_sync_waitq(void *udata) {
+    (void)udata;
+    assert(sco_waitq_wait(&sync_wq));
+    sync_total++;
+}
+
+void co_sync_recv(void *udata) {
+    (void)udata;
+    int val;
+    int expect = 0;
+    while (sco_chan_recv(&sync_chan, &val)) {
+        assert(val == expect++);
+        sync_total++;
+    }
+}
+
+void co_sync_send(void *udata) {
+    (void)udata;
+    for (int i = 0; i < NCHILDREN; i++) {
+        assert(sco_chan_send(&sync_chan, &i));
+        assert(sync_chan.len <= sync_chan.cap);
+    }
+    sco_chan_close(&sync_chan);
+    int val = 0;
+    assert(!sco_chan_send(&sync_chan, &val));
+}
+
+void test_sco_sync(void) {
+    reset_stats();
+    // mutex
+    sync_mu = (struct sco_mutex){ 0 };
+    sync_inside = 0;
+    sync_maxinside = 0;
+    quick_start(co_sync_start, co_cleanup, &sync_mu);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(!sync_mu.locked);
+    assert(sync_maxinside == 9); // every other coroutine waited at once
+    assert(sco_mutex_trylock(&sync_mu));
+    assert(!sco_mutex_lock(&sync_mu)); // not a coroutine
+    sco_mutex_unlock(&sync_mu);
+    // semaphore
+    sync_sem = (struct sco_sem){ .count = 3 };
+    sync_maxinside = 0;
+    quick_start(co_sync_start, co_cleanup, &sync_sem);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sync_maxinside == 3);
+    assert(sync_sem.count == 3);
+    assert(sco_sem_trywait(&sync_sem));
+    sco_sem_post(&sync_sem);
+    // wait queue
+    sync_wq = (struct sco_waitq){ 0 };
+    sync_total = 0;
+    for (int i = 0; i < 10; i++) {
+        quick_start(co_sync_waitq, co_cleanup, 0);
+    }
+    assert(sync_wq.count == 10);
+    assert(sco_waitq_notify(&sync_wq));
+    assert(sco_waitq_notify_all(&sync_wq) == 9);
+    assert(!sco_waitq_notify(&sync_wq));
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sync_total == 10);
+    // channel
+    int buf[4];
+    sco_chan_init(&sync_chan, buf, sizeof(int), 4);
+    sync_total = 0;
+    quick_start(co_sync_recv, co_cleanup, 0);
+    quick_start(co_sync_send, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sync_total == NCHILDREN);
+}
+
+static int group_done = 0;
+
+void co_group_child(void *udata) {
+    int n = *(int*)udata;
+    for (int i = 0; i < n; i++) {
+        sco_yield();
+    }
+    group_done++;
+}
+
+void co_group_exit(void *udata) {
+    (void)udata;
+    sco_yield();
+    group_done++;
+    sco_exit();
+}
+
+void co_group_parent(void *udata) {
+    (void)udata;
+    struct sco_group group = { 0 };
+    assert(sco_group_wait(&group));
+    int counts[10];
+    for (int i = 0; i < 10; i++) {
+        counts[i] = i%3;
+        void *stack = xmalloc(STACK_SIZE);
+        started++;
+        sco_start(&(struct sco_desc){
+            .stack = stack,
+            .stack_size = STACK_SIZE,
+            .entry = co_group_child,
+            .udata = &counts[i],
+            .cleanup = co_cleanup,
+            .group = &group,
+        });
+    }
+    // Finished right away.
+    assert(group.count == 6);
+    void *stack = xmalloc(STACK_SIZE);
+    started++;
+    sco_spawn(&(struct sco_desc){
+        .stack = stack,
+        .stack_size = STACK_SIZE,
+        .entry = co_group_child,
+        .udata = &counts[2],
+        .cleanup = co_cleanup,
+        .group = &group,
+    });
+    sco_start_worker(&(struct sco_desc){
+        .entry = co_group_child,
+        .udata = &counts[1],
+        .group = &group,
+    });
+    assert(group.count == 8);
+    assert(sco_group_wait(&group));
+    assert(group.count == 0 && group_done == 12);
+    // A parked worker joins the group that it's woken with.
+    sco_start_worker(&(struct sco_desc){
+        .entry = co_group_child,
+        .udata = &counts[1],
+        .group = &group,
+    });
+    assert(group.count == 1);
+    assert(sco_group_wait(&group));
+    assert(group.count == 0 && group_done == 13);
+    // Children that end with sco_exit() leave the group too.
+    for (int i = 0; i < 3; i++) {
+        void *stack = xmalloc(STACK_SIZE);
+        started++;
+        sco_start(&(struct sco_desc){
+            .stack = stack,
+            .stack_size = STACK_SIZE,
+            .entry = co_group_exit,
+            .cleanup = co_cleanup,
+            .group = &group,
+        });
+    }
+    assert(group.count == 3);
+    assert(sco_group_wait(&group));
+    assert(group.count == 0 && group_done == 16);
+}
+
+void test_sco_group(void) {
+    reset_stats();
+    group_done = 0;
+    assert(sco_group_wait(&(struct sco_group){ 0 }));
+    assert(!sco_group_wait(&(struct sco_group){ .count = 1 }));
+    quick_start(co_group_parent, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(group_done == 16);
+    assert(started == cleaned);
+    sco_stack_trim();
+}
+
+static int nspawned = 0;
+static int spawn_order[NCHILDREN];
+
+void co_spawned(void *udata) {
+    spawn_order[nspawned++] = (int)(intptr_t)udata;
+    sco_yield();
+}
+
+void co_spawner(void *udata) {
+    (void)udata;
+    struct sco_desc descs[NCHILDREN/2];
+    int64_t ids[NCHILDREN/2];
+    for (int i = 0; i < NCHILDREN/2; i++) {
+        started++;
+        int64_t id = sco_spawn(&(struct sco_desc){
+            .stack = xmalloc(STACK_SIZE),
+            .stack_size = STACK_SIZE,
+            .entry = co_spawned,
+            .cleanup = co_cleanup,
+            .udata = (void*)(intptr_t)i,
+        });
+        assert(id > 0);
+    }
+    for (int i = 0; i < NCHILDREN/2; i++) {
+        started++;
+        descs[i] = (struct sco_desc){
+            .stack = xmalloc(STACK_SIZE),
+            .stack_size = STACK_SIZE,
+            .entry = co_spawned,
+            .cleanup = co_cleanup,
+            .udata = (void*)(intptr_t)(NCHILDREN/2+i),
+        };
+    }
+    sco_spawn_many(descs, NCHILDREN/2, ids);
+    for (int i = 1; i < NCHILDREN/2; i++) {
+        assert(ids[i] == ids[i-1]+1);
+    }
+    // None of them have run yet.
+    assert(nspawned == 0);
+    assert(sco_info_scheduled() == NCHILDREN);
+    sco_yield();
+    assert(nspawned == NCHILDREN);
+}
+
+void test_sco_spawn(void) {
+    reset_stats();
+    nspawned = 0;
+    quick_start(co_spawner, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nspawned == NCHILDREN);
+    for (int i = 0; i < NCHILDREN; i++) {
+        assert(spawn_order[i] == i);
+    }
+    // Spawning from main does not run anything until the runloop.
+    nspawned = 0;
+    started++;
+    sco_spawn(&(struct sco_desc){
+        .stack = xmalloc(STACK_SIZE),
+        .stack_size = STACK_SIZE,
+        .entry = co_spawned,
+        .cleanup = co_cleanup,
+    });
+    assert(nspawned == 0 && sco_active());
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nspawned == 1);
+}
+
+static int64_t many_ids[NCHILDREN+1];
+static int nmany = 0;
+static int nmany_woken = 0;
+
+void co_many_one(void *udata) {
+    (void)udata;
+    many_ids[nmany++] = sco_id();
+    sco_pause();
+    nmany_woken++;
+}
+
+void co_many_all(void *udata) {
+    (void)udata;
+    many_ids[NCHILDREN] = -1; // not a coroutine
+    // Resume the first half without yielding.
+    assert(sco_resume_many_noyield(many_ids, NCHILDREN/2) == NCHILDREN/2);
+    assert(nmany_woken == 0);
+    assert(sco_info_scheduled() == NCHILDREN/2);
+    // Resume the rest, which runs all of them before coming back.
+    size_t n = NCHILDREN-NCHILDREN/2+1;
+    assert(sco_resume_many(many_ids+NCHILDREN/2, n) == n-1);
+    assert(nmany_woken == NCHILDREN);
+    // Nobody is paused anymore.
+    assert(sco_resume_many(many_ids, NCHILDREN) == 0);
+}
+
+void test_sco_resume_many(void) {
+    reset_stats();
+    nmany = 0;
+    nmany_woken = 0;
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_many_one, co_cleanup, 0);
+    }
+    assert(nmany == NCHILDREN);
+    quick_start(co_many_all, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nmany_woken == NCHILDREN);
+}
+
+static void prio_start(void(*entry)(void*), int priority) {
+    void *stack = xmalloc(STACK_SIZE);
+    assert(stack);
+    started++;
+    sco_start(&(struct sco_desc){
+        .stack = stack,
+        .stack_size = STACK_SIZE,
+        .entry = entry,
+        .cleanup = co_cleanup,
+        .priority = priority,
+    });
+}
+
+static char prio_log[16];
+static int nprio_log = 0;
+static bool prio_spinning = false;
+static int prio_turns = 0;
+
+void co_prio_one(void *udata) {
+    (void)udata;
+    sco_yield();
+    int priority = sco_priority();
+    prio_log[nprio_log++] = priority == SCO_PRIO_HIGH ? 'H' : 
+                            priority == SCO_PRIO_LOW ? 'L' : 'N';
+}
+
+void co_prio_order(void *udata) {
+    (void)udata;
+    assert(sco_priority() == SCO_PRIO_NORMAL);
+    for (int i = 0; i < 3; i++) {
+        prio_start(co_prio_one, SCO_PRIO_LOW);
+    }
+    for (int i = 0; i < 3; i++) {
+        prio_start(co_prio_one, SCO_PRIO_NORMAL);
+    }
+    for (int i = 0; i < 3; i++) {
+        prio_start(co_prio_one, SCO_PRIO_HIGH);
+    }
+}
+
+void co_prio_spin(void *udata) {
+    (void)udata;
+    prio_spinning = true;
+    for (int i = 0; i < 160; i++) {
+        sco_yield();
+    }
+    prio_spinning = false;
+}
+
+void co_prio_starved(void *udata) {
+    (void)udata;
+    sco_yield();
+    while (prio_spinning) {
+        prio_turns++;
+        sco_yield();
+    }
+}
+
+void co_prio_starve(void *udata) {
+    (void)udata;
+    prio_start(co_prio_starved, SCO_PRIO_NORMAL);
+    // Raise and clamp the priority of the spinner.
+    sco_set_priority(100);
+    assert(sco_priority() == SCO_PRIO_HIGH);
+    co_prio_spin(0);
+}
+
+void test_sco_priority(void) {
+    reset_stats();
+    assert(sco_priority() == SCO_PRIO_NORMAL);
+    nprio_log = 0;
+    quick_start(co_prio_order, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nprio_log == 9);
+    assert(memcmp(prio_log, "HHHNNNLLL", 9) == 0);
+    // A spinning high priority coroutine cannot starve the normal ones.
+    prio_turns = 0;
+    quick_start(co_prio_starve, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(prio_turns > 0 && prio_turns <= 160/16+1);
+}
+
+static int64_t stats_ids[NCHILDREN];
+static int nstats_ids = 0;
+
+void co_stats(void *udata) {
+    (void)udata;
+    stats_ids[nstats_ids++] = sco_id();
+    sco_yield();
+    sco_pause();
+}
+
+void co_stats_sleep(void *udata) {
+    (void)udata;
+    sco_sleep(1000000);
+    sco_sleep(-1);
+}
+
+void test_sco_stats(void) {
+    reset_stats();
+    struct sco_stats before;
+#ifndef SCO_STATS
+    assert(!sco_stats_get(&before));
+    assert(before.switches == 0);
+#else
+    struct sco_stats after;
+    assert(sco_stats_get(&before));
+    nstats_ids = 0;
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_stats, co_cleanup, 0);
+    }
+    while (sco_info_paused() < NCHILDREN) {
+        sco_resume(0);
+    }
+    assert(sco_resume_many_noyield(stats_ids, NCHILDREN) == NCHILDREN);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    sco_stats_get(&after);
+    assert(after.starts-before.starts == NCHILDREN);
+    assert(after.exits-before.exits == NCHILDREN);
+    assert(after.yields-before.yields == NCHILDREN);
+    assert(after.pauses-before.pauses == NCHILDREN);
+    assert(after.resumes-before.resumes == NCHILDREN);
+    // Every switch, other than into a new coroutine, ends a run queue wait.
+    assert(after.switches-before.switches == NCHILDREN*2);
+    assert(after.waits-before.waits == NCHILDREN*2);
+    uint64_t nhist = 0;
+    for (int i = 0; i < SCO_STATS_NBUCKETS; i++) {
+        nhist += after.wait_hist[i]-before.wait_hist[i];
+    }
+    assert(nhist == NCHILDREN*2);
+
+    // A sleep pauses the coroutine until its timer resumes it, and a sleep
+    // that has already passed only yields.
+    sco_stats_get(&before);
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_stats_sleep, co_cleanup, 0);
+    }
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    sco_stats_get(&after);
+    assert(after.pauses-before.pauses == NCHILDREN);
+    assert(after.resumes-before.resumes == NCHILDREN);
+    assert(after.yields-before.yields == NCHILDREN);
+#endif
+}
+
+static int64_t slice_hog_id = 0;
+static int slice_hooked = 0;
+static int slice_frames = 0;
+
+bool slice_symbol(struct sco_symbol *sym, void *udata) {
+    (void)sym, (void)udata;
+    slice_frames++;
+    return true;
+}
+
+void slice_hook(int64_t id, int64_t slice, void *udata) {
+    assert(udata == &slice_hooked);
+    assert(id == slice_hog_id);
+    assert(slice > 2000000);
+    slice_hooked++;
+    sco_unwind(slice_symbol, 0);
+}
+
+void co_slice_hog(void *udata) {
+    (void)udata;
+    slice_hog_id = sco_id();
+    int64_t start = getnow();
+    while (getnow()-start < 3000000) { } // busy for 3 ms
+#ifdef SCO_STATS
+    assert(sco_cputime() >= 3000000);
+#endif
+    sco_yield();
+}
+
+void co_slice_ok(void *udata) {
+    (void)udata;
+    sco_yield();
+#ifdef SCO_STATS
+    assert(sco_cputime() >= 0 && sco_cputime() < 2000000);
+#endif
+}
+
+void test_sco_slice(void) {
+    reset_stats();
+    assert(sco_cputime() == -1);
+    slice_hooked = 0;
+    slice_frames = 0;
+    sco_set_slice_hook(2000000, slice_hook, &slice_hooked);
+    for (int i = 0; i < 10; i++) {
+        quick_start(co_slice_ok, co_cleanup, 0);
+    }
+    quick_start(co_slice_hog, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    sco_set_slice_hook(0, NULL, NULL);
+#ifdef SCO_STATS
+    assert(slice_hooked == 1);
+    assert(slice_frames > 0);
+#else
+    assert(slice_hooked == 0);
+#endif
+}
+
+static int quantum_yields = 0;
+static int quantum_others = 0;
+
+void co_quantum_hog(void *udata) {
+    (void)udata;
+    // Each slice starts after the time that was taken before the switch.
+    int64_t last = getnow();
+    sco_yield();
+    int64_t start = getnow();
+    while (getnow()-start < 30000000) {
+        int64_t before = getnow();
+        if (sco_maybe_yield()) {
+            // Never before the quantum is up.
+            assert(getnow()-last >= 2000000);
+            quantum_yields++;
+            last = before;
+        }
+    }
+}
+
+void co_quantum_other(void *udata) {
+    (void)udata;
+    assert(!sco_maybe_yield());
+    while (quantum_yields < 2) {
+        quantum_others++;
+        sco_yield();
+    }
+}
+
+void co_quantum_starter(void *udata) {
+    (void)udata;
+    quick_start(co_quantum_other, co_cleanup, 0);
+    quick_start(co_quantum_hog, co_cleanup, 0);
+}
+
+void test_sco_quantum(void) {
+    quantum_yields = 0;
+    quantum_others = 0;
+    assert(!sco_maybe_yield());
+    quick_start(co_quantum_hog, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    // Without a quantum the hog keeps the CPU.
+    assert(quantum_yields == 0);
+
+    assert(sco_set_quantum(2000000));
+    quick_start(co_quantum_starter, co_cleanup, 0);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(quantum_yields >= 2 && quantum_others >= 2);
+    assert(sco_set_quantum(0));
+    assert(!sco_maybe_yield());
+}
+
+static void *pooled_addr = NULL;
+static int pooled_cleaned = 0;
+
+void co_pooled(void *udata) {
+    int x = 0;
+    if (udata) {
+        pooled_addr = &x;
+    } else {
+        // The stack from the previous coroutine was reused.
+        assert(pooled_addr == &x);
+    }
+    sco_yield();
+}
+
+void co_pooled_cleanup(void *stack, size_t stack_size, void *udata) {
+    (void)udata;
+    assert(stack && stack_size >= STACK_SIZE);
+    pooled_cleaned++;
+}
+
+void test_sco_pooled(void) {
+    pooled_cleaned = 0;
+    sco_start_pooled(&(struct sco_desc){ 
+        .entry = co_pooled, 
+        .cleanup = co_pooled_cleanup,
+        .udata = &pooled_addr,
+    });
+    assert(sco_info_stacks() == 1);
+    sco_start_pooled(&(struct sco_desc){ 
+        .entry = co_pooled,
+        .cleanup = co_pooled_cleanup,
+    });
+    assert(sco_info_stacks() == 1);
+    for (int i = 0; i < NCHILDREN; i++) {
+        sco_start_pooled(&(struct sco_desc){ 
+            .entry = co_pooled,
+            .stack_size = STACK_SIZE*3,
+            .udata = &pooled_addr,
+        });
+    }
+    assert(pooled_cleaned == 2);
+    assert(sco_info_stacks() == 2);
+    sco_stack_trim();
+    assert(sco_info_stacks() == 0);
+}
+
+#define NWORKERS 10
+
+static void *worker_addrs[NWORKERS];
+static int64_t worker_ids[NWORKERS*2];
+static int nworker_runs = 0;
+
+void co_worker(void *udata) {
+    int x = 0;
+    int i = nworker_runs++;
+    assert(udata == &worker_ids[i]);
+    worker_ids[i] = sco_id();
+    if (i < NWORKERS) {
+        worker_addrs[i] = &x;
+    } else {
+        // Running on the stack of one of the parked workers.
+        bool found = false;
+        for (int j = 0; j < NWORKERS; j++) {
+            found = found || worker_addrs[j] == &x;
+        }
+        assert(found);
+    }
+    sco_yield();
+}
+
+void co_worker_starter(void *udata) {
+    int start = *(int*)udata;
+    for (int i = start; i < start+NWORKERS; i++) {
+        sco_start_worker(&(struct sco_desc){
+            .entry = co_worker,
+            .udata = &worker_ids[i],
+        });
+    }
+}
+
+void test_sco_worker(void) {
+    reset_stats();
+    nworker_runs = 0;
+    sco_stack_trim();
+#ifdef SCO_STATS
+    struct sco_stats before, after;
+    sco_stats_get(&before);
+#endif
+    // The workers all run at the same time, each on its own stack.
+    int start = 0;
+    quick_start(co_worker_starter, co_cleanup, &start);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sco_info_workers() == NWORKERS);
+    assert(sco_info_stacks() == 0);
+    // And then again, reusing the parked workers.
+    start = NWORKERS;
+    quick_start(co_worker_starter, co_cleanup, &start);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(nworker_runs == NWORKERS*2);
+    assert(sco_info_workers() == NWORKERS);
+    for (int i = 1; i < NWORKERS*2; i++) {
+        assert(worker_ids[i] > worker_ids[i-1]);
+    }
+#ifdef SCO_STATS
+    // Each task and starter exits once, and finishing a parked worker
+    // doesn't count again.
+    sco_stats_get(&after);
+    assert(after.exits-before.exits == NWORKERS*2+2);
+#endif
+    sco_stack_trim();
+    assert(sco_info_workers() == 0);
+    assert(sco_info_stacks() == 0);
+#ifdef SCO_STATS
+    sco_stats_get(&after);
+    assert(after.exits-before.exits == NWORKERS*2+2);
+    assert(after.starts-before.starts == NWORKERS*2+2);
+#endif
+}
+
+void test_sco_node(void) {
+    int node = sco_node();
+    assert(node >= 0);
+    sco_set_node(0);
+    assert(sco_node() == 0);
+    // Stacks are bound to node 0, which always exists.
+    sco_start_pooled(&(struct sco_desc){ 
+        .entry = co_pooled,
+        .udata = &pooled_addr,
+    });
+    sco_set_node(-1);
+    assert(sco_node() == node);
+    sco_stack_trim();
+}
+
+static int stack_touch(int depth) {
+    volatile char buf[4096];
+    buf[0] = (char)depth;
+    return depth == 0 ? buf[0] : stack_touch(depth-1) + buf[0];
+}
+
+void co_stack_info(void *udata) {
+    (void)udata;
+    struct sco_stack_info info;
+    if (!sco_stack_info(&info)) {
+        return;
+    }
+    assert(info.stack && info.stack_size >= STACK_SIZE);
+    assert(info.resident > 0 && info.resident <= info.stack_size);
+    assert(info.highwater > 0 && info.highwater <= info.stack_size);
+    size_t highwater = info.highwater;
+    stack_touch(16);
+    assert(sco_stack_info(&info));
+    assert(info.highwater >= 16*4096 && info.highwater > highwater);
+}
+
+void test_sco_stack_info(void) {
+    struct sco_stack_info info;
+    assert(!sco_stack_info(&info));
+    sco_start_pooled(&(struct sco_desc){ .entry = co_stack_info });
+    sco_stack_trim();
+}
+
+static int pollfds[2];
+static int pollread = 0;
+
+void co_poll_reader(void *udata) {
+    (void)udata;
+    char buf[8];
+    assert(sco_wait_fd(pollfds[0], SCO_READ) == SCO_READ);
+    assert(read(pollfds[0], buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, "hello", 5) == 0);
+    pollread++;
+}
+
+void co_poll_writer(void *udata) {
+    (void)udata;
+    assert(sco_wait_fd(pollfds[1], SCO_WRITE|SCO_READ) == SCO_WRITE);
+    assert(write(pollfds[1], "hello", 5) == 5);
+}
+
+void test_sco_poll(void) {
+    reset_stats();
+    pollread = 0;
+    assert(sco_wait_fd(0, SCO_READ) == -1);
+    assert(sco_poll(-1) == 0);
+    assert(pipe(pollfds) == 0);
+    quick_start(co_poll_reader, co_cleanup, 0);
+    assert(sco_info_paused() == 1);
+    assert(sco_poll(0) == 0);
+    quick_start(co_poll_writer, co_cleanup, 0);
+    assert(sco_info_paused() == 2);
+    while (sco_active()) {
+        assert(sco_poll(sco_info_scheduled() > 0 ? 0 : -1) >= 0);
+        sco_resume(0);
+    }
+    assert(pollread == 1);
+    close(pollfds[0]);
+    close(pollfds[1]);
+}
+
+static int timer_order[NCHILDREN];
+static int ntimer_order = 0;
+static int64_t timer_long_id = 0;
+static int64_t timer_base = 0;
+
+void co_timer_one(void *udata) {
+    int index = *(int*)udata;
+    // The deadlines are two ticks apart and share one base, so a stall
+    // between two starts cannot reorder them.
+    int64_t deadline = timer_base+(NCHILDREN-index)*INT64_C(2000000);
+    sco_sleep_until(deadline);
+    assert(sco_now() >= deadline);
+    timer_order[ntimer_order++] = index;
+}
+
+void co_timer_long(void *udata) {
+    (void)udata;
+    timer_long_id = sco_id();
+    int64_t start = sco_now();
+    sco_sleep(INT64_C(10000000000)); // 10 seconds
+    // Woken up early by co_timer_waker
+    assert(sco_now()-start < INT64_C(1000000000));
+}
+
+void co_timer_waker(void *udata) {
+    (void)udata;
+    sco_sleep_until(sco_now()+INT64_C(5000000));
+    sco_resume(timer_long_id);
+}
+
+void test_sco_timer(void) {
+    reset_stats();
+    ntimer_order = 0;
+    assert(sco_next_deadline() == -1);
+    // Leave time for starting all of them before the first deadline.
+    timer_base = sco_now()+INT64_C(50000000);
+    for (int i = 0; i < NCHILDREN; i++) {
+        quick_start(co_timer_one, co_cleanup, &i);
+    }
+    quick_start(co_timer_long, co_cleanup, 0);
+    quick_start(co_timer_waker, co_cleanup, 0);
+    assert(sco_info_sleeping() == NCHILDREN+2);
+    assert(sco_info_paused() == NCHILDREN+2);
+    assert(sco_next_deadline() >= 0);
+    while (sco_active()) {
+        sco_poll(sco_info_scheduled() > 0 ? 0 : sco_next_deadline());
+        sco_resume(0);
+    }
+    assert(sco_info_sleeping() == 0);
+    assert(sco_next_deadline() == -1);
+    assert(ntimer_order == NCHILDREN);
+    for (int i = 0; i < NCHILDREN; i++) {
+        assert(timer_order[i] == NCHILDREN-1-i);
+    }
+}
 
 int exitvals[6] = { 0 };
 int nexitvals = 0;
 
 void co_two(void *udata) {
     (void)udata;
-    sco_sleep(1e7*2);
+    cpu_sleep(1e7*2);
     exitvals[nexitvals++] = 2;
 }
 
 void co_three(void *udata) {
     (void)udata;
-    sco_sleep(1e7);
+    cpu_sleep(1e7);
     exitvals[nexitvals++] = 3;
 }
 
@@ -350,16 +1584,509 @@ void test_sco_unwind(void) {
     sco_unwind(symbol, &x);
 }
 
+struct unwind_ctx {
+    int64_t id;
+    void *ips[64];
+    int nips;
+    void *syms[64];
+    int nsyms;
+};
+
+bool unwind_collect(struct sco_symbol *sym, void *udata) {
+    struct unwind_ctx *ctx = udata;
+    if (ctx->nsyms < 64) {
+        ctx->syms[ctx->nsyms++] = sym->ip;
+    }
+    return true;
+}
+
+__attribute__((noinline))
+void unwind_leaf(struct unwind_ctx *ctx) {
+    ctx->nips = sco_unwind_ips(ctx->ips, 64);
+    sco_unwind(unwind_collect, ctx);
+    sco_pause();
+}
+
+void co_unwind(void *udata) {
+    struct unwind_ctx *ctx = udata;
+    ctx->id = sco_id();
+    unwind_leaf(ctx);
+}
+
+void test_sco_unwind_ips(void) {
+    void *ips[64];
+    assert(sco_unwind_ips(ips, 64) == 0); // not in a coroutine
+    struct unwind_ctx ctx = { 0 };
+    quick_start(co_unwind, co_cleanup, &ctx);
+    assert(sco_info_paused() == 1);
+    int n = sco_unwind_paused(ctx.id, ips, 64);
+    assert(sco_unwind_paused(ctx.id+1, ips, 64) == 0);
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32) && \
+    !defined(__OPTIMIZE__)
+    if (strncmp(sco_info_method(), "asm", 3) == 0) {
+        // Both unwinders agree on the frames above the leaf.
+        assert(ctx.nips >= 2 && ctx.nsyms >= 2);
+        assert(ctx.ips[1] == ctx.syms[1]);
+        // The paused stack goes through the same frame.
+        bool found = false;
+        for (int i = 0; i < n; i++) {
+            found = found || ips[i] == ctx.ips[1];
+        }
+        assert(found);
+        struct sco_symbol sym, sym2;
+        assert(sco_symbolize(ctx.ips[0], &sym));
+        assert(sym.ip == ctx.ips[0] && sym.fname && !sym.cfa);
+        assert(sco_symbolize(ctx.ips[0], &sym2));
+        assert(sym2.fname == sym.fname && sym2.saddr == sym.saddr);
+    }
+#else
+    (void)n;
+#endif
+    sco_resume(ctx.id);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+}
+
+struct dump_ctx {
+    int64_t paused[3];
+    int64_t sleeper;
+    int64_t yielder;
+    struct sco_waitq wq;
+    bool done;
+};
+
+__attribute__((noinline))
+void dump_pause_here(void) {
+    sco_pause();
+}
+
+void co_dump_pause(void *udata) {
+    struct dump_ctx *ctx = udata;
+    for (int i = 0; i < 3; i++) {
+        if (!ctx->paused[i]) {
+            ctx->paused[i] = sco_id();
+            break;
+        }
+    }
+    dump_pause_here();
+}
+
+void co_dump_sleep(void *udata) {
+    struct dump_ctx *ctx = udata;
+    ctx->sleeper = sco_id();
+    sco_sleep(INT64_C(60000000000));
+}
+
+void co_dump_block(void *udata) {
+    struct dump_ctx *ctx = udata;
+    assert(sco_waitq_wait(&ctx->wq));
+}
+
+void co_dump_yield(void *udata) {
+    struct dump_ctx *ctx = udata;
+    ctx->yielder = sco_id();
+    while (!ctx->done) {
+        sco_yield();
+    }
+}
+
+void co_dump(void *udata) {
+    struct dump_ctx *ctx = udata;
+    for (int i = 0; i < 3; i++) {
+        quick_start(co_dump_pause, co_cleanup, ctx);
+    }
+    quick_start(co_dump_sleep, co_cleanup, ctx);
+    quick_start(co_dump_block, co_cleanup, ctx);
+    quick_start(co_dump_yield, co_cleanup, ctx);
+    sco_yield();
+
+    // Take the dump two at a time.
+    int counts[7] = { 0 };
+    int64_t ids[8];
+    size_t nids = 0;
+    struct sco_dump_iter iter = { 0 };
+    struct sco_dump_info infos[2];
+    size_t n;
+    while ((n = sco_dump(&iter, infos, 2)) > 0) {
+        assert(n <= 2);
+        for (size_t i = 0; i < n; i++) {
+            assert(infos[i].state >= 1 && infos[i].state <= 6);
+            assert(infos[i].stack && infos[i].stack_size == STACK_SIZE);
+            assert(infos[i].priority == SCO_PRIO_NORMAL);
+            assert(infos[i].udata == ctx);
+            counts[infos[i].state]++;
+            for (size_t j = 0; j < nids; j++) {
+                assert(ids[j] != infos[i].id);
+            }
+            assert(nids < 8);
+            ids[nids++] = infos[i].id;
+        }
+    }
+    assert(sco_dump(&iter, infos, 2) == 0);
+    assert(nids == 7);
+    assert(counts[SCO_STATE_RUNNING] == 1 && ids[0] == sco_id());
+    assert(counts[SCO_STATE_SCHEDULED] == 1);
+    assert(counts[SCO_STATE_PAUSED] == 3);
+    assert(counts[SCO_STATE_SLEEPING] == 1);
+    assert(counts[SCO_STATE_BLOCKED] == 1);
+
+    // Group the stacks, three at a time.
+    struct sco_stack_sig sigs[8];
+    size_t nsigs = 0;
+    size_t total = 0;
+    iter = (struct sco_dump_iter){ 0 };
+    while ((n = sco_dump_stacks(&iter, 3, sigs, &nsigs, 8)) > 0) {
+        total += n;
+    }
+    assert(total == 7);
+    size_t counted = 0;
+    for (size_t i = 0; i < nsigs; i++) {
+        counted += sigs[i].count;
+    }
+    assert(counted == 7);
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32) && \
+    !defined(__OPTIMIZE__)
+    if (strncmp(sco_info_method(), "asm", 3) == 0) {
+        // The three paused coroutines share a stack.
+        bool found = false;
+        for (size_t i = 0; i < nsigs; i++) {
+            if (sigs[i].count == 3) {
+                assert(sigs[i].hash && sigs[i].nips > 0);
+                assert(sigs[i].id == ctx->paused[0] || 
+                    sigs[i].id == ctx->paused[1] ||
+                    sigs[i].id == ctx->paused[2]);
+                found = true;
+            }
+        }
+        assert(found);
+    }
+#endif
+    // With no room, nothing is counted.
+    nsigs = 0;
+    iter = (struct sco_dump_iter){ 0 };
+    assert(sco_dump_stacks(&iter, 100, sigs, &nsigs, 0) == 7 && nsigs == 0);
+
+    ctx->done = true;
+    for (int i = 0; i < 3; i++) {
+        sco_resume(ctx->paused[i]);
+    }
+    sco_resume(ctx->sleeper);
+    assert(sco_waitq_notify(&ctx->wq));
+}
+
+void test_sco_dump(void) {
+    struct dump_ctx ctx = { 0 };
+    struct sco_dump_iter iter = { 0 };
+    struct sco_dump_info info;
+    assert(sco_dump(&iter, &info, 1) == 0);
+    quick_start(co_dump, co_cleanup, &ctx);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    iter = (struct sco_dump_iter){ 0 };
+    assert(sco_dump(&iter, &info, 1) == 0);
+}
+
+#define NDUMPBLOCKED 16
+
+static struct sco_waitq dump_wqs[2];
+static int64_t dump_blocked_ids[NDUMPBLOCKED];
+
+void co_dump_blocked(void *udata) {
+    int index = *(int*)udata;
+    dump_blocked_ids[index] = sco_id();
+    assert(sco_waitq_wait(&dump_wqs[index&1]));
+}
+
+void test_sco_dump_batches(void) {
+    memset(dump_wqs, 0, sizeof(dump_wqs));
+    for (int i = 0; i < NDUMPBLOCKED; i++) {
+        quick_start(co_dump_blocked, co_cleanup, &i);
+    }
+    // Wake the oldest even waiter after every batch of the blocked list, 
+    // which is the coroutine visited first, and later the one that the next
+    // batch starts at. Every odd waiter must still be seen exactly once.
+    int seen[NDUMPBLOCKED] = { 0 };
+    struct sco_dump_iter iter = { 0 };
+    struct sco_dump_info info;
+    while (sco_dump(&iter, &info, 1) > 0) {
+        assert(info.state == SCO_STATE_BLOCKED);
+        for (int i = 0; i < NDUMPBLOCKED; i++) {
+            if (dump_blocked_ids[i] == info.id) {
+                seen[i]++;
+            }
+        }
+        sco_waitq_notify(&dump_wqs[0]);
+    }
+    for (int i = 1; i < NDUMPBLOCKED; i += 2) {
+        assert(seen[i] == 1);
+    }
+    for (int i = 0; i < NDUMPBLOCKED; i++) {
+        assert(seen[i] <= 1);
+    }
+    assert(sco_waitq_notify_all(&dump_wqs[0]) == 0);
+    assert(sco_waitq_notify_all(&dump_wqs[1]) == NDUMPBLOCKED/2);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+}
+
+static char record_out[16];
+static int record_len = 0;
+
+void co_record_letter(void *udata) {
+    char letter = (char)(intptr_t)udata;
+    record_out[record_len++] = letter;
+    sco_yield();
+    record_out[record_len++] = letter;
+}
+
+void co_record_starter(void *udata) {
+    int64_t *ids = udata;
+    for (int i = 0; i < 3; i++) {
+        ids[i] = sco_spawn(&(struct sco_desc){
+            .stack = xmalloc(STACK_SIZE),
+            .stack_size = STACK_SIZE,
+            .entry = co_record_letter,
+            .cleanup = co_cleanup,
+            .udata = (void*)(intptr_t)('A'+i),
+        });
+    }
+}
+
+// Run the scenario and return the order that the coroutines ran in.
+const char *record_run(int64_t *ids) {
+    record_len = 0;
+    quick_start(co_record_starter, co_cleanup, ids);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    record_out[record_len] = '\0';
+    return record_out;
+}
+
+void co_record_sleeper(void *udata) {
+    char letter = (char)(intptr_t)udata;
+    sco_sleep((letter-'A'+1)*INT64_C(1000000));
+    record_out[record_len++] = letter;
+}
+
+void co_record_sleep_starter(void *udata) {
+    int64_t *ids = udata;
+    for (int i = 0; i < 3; i++) {
+        ids[i] = sco_spawn(&(struct sco_desc){
+            .stack = xmalloc(STACK_SIZE),
+            .stack_size = STACK_SIZE,
+            .entry = co_record_sleeper,
+            .cleanup = co_cleanup,
+            .udata = (void*)(intptr_t)('A'+i),
+        });
+    }
+}
+
+// Same as record_run, with coroutines that sleep for 1, 2 and 3 ms.
+const char *record_sleep_run(int64_t *ids) {
+    record_len = 0;
+    quick_start(co_record_sleep_starter, co_cleanup, ids);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    record_out[record_len] = '\0';
+    return record_out;
+}
+
+// Shift the ids in the log to the ids of another run, swapping two of them.
+void record_remap(uint64_t *log, size_t n, int64_t *from, int64_t *to,
+    int swap1, int swap2)
+{
+    for (size_t i = 0; i < n; i++) {
+        int64_t id = SCO_EVENT_ID(log[i]);
+        int64_t nid = id ? id-from[0]+to[0] : 0;
+        for (int j = 0; j < 3; j++) {
+            if (id == from[j] && j == swap1) {
+                nid = to[swap2];
+            } else if (id == from[j] && j == swap2) {
+                nid = to[swap1];
+            }
+        }
+        log[i] = (uint64_t)SCO_EVENT_TYPE(log[i])<<56 | (uint64_t)nid;
+    }
+}
+
+void test_sco_record(void) {
+    uint64_t log[64];
+    int64_t ids1[3], ids2[3], ids3[3];
+    assert(sco_record_get(log, 64) == 0);
+    assert(sco_record_start(4));
+    assert(!sco_record_start(4));
+    assert(!sco_replay_start(log, 1));
+    assert(strcmp(record_run(ids1), "ABCABC") == 0);
+    // The small ring only keeps the last events.
+    assert(sco_record_get(log, 64) == 4);
+    assert(SCO_EVENT_TYPE(log[3]) == SCO_EVENT_SWITCH);
+    assert(SCO_EVENT_ID(log[3]) == 0);
+    sco_record_stop();
+
+    assert(sco_record_start(64));
+    assert(strcmp(record_run(ids1), "ABCABC") == 0);
+    size_t n = sco_record_get(log, 64);
+    sco_record_stop();
+    assert(n > 12 && n < 64);
+    assert(SCO_EVENT_TYPE(log[0]) == SCO_EVENT_START);
+    assert(SCO_EVENT_TYPE(log[n-1]) == SCO_EVENT_SWITCH);
+    assert(SCO_EVENT_ID(log[n-1]) == 0);
+    int counts[16] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        counts[SCO_EVENT_TYPE(log[i])]++;
+    }
+    assert(counts[SCO_EVENT_START] == 4 && counts[SCO_EVENT_EXIT] == 4);
+
+    // Replaying the log as recorded matches all of it. The ids of the next
+    // run follow on from the last one.
+    int64_t next[3] = { ids1[2]+2, ids1[2]+3, ids1[2]+4 };
+    record_remap(log, n, ids1, next, 0, 0);
+    assert(sco_replay_start(log, n));
+    assert(sco_replaying());
+    assert(strcmp(record_run(ids2), "ABCABC") == 0);
+    assert(ids2[0] == next[0]);
+    assert(!sco_replaying());
+    assert(sco_replay_stop() == n);
+
+    // Swapping the first and the last coroutine in the log makes them run
+    // in that order instead.
+    int64_t next2[3] = { ids2[2]+2, ids2[2]+3, ids2[2]+4 };
+    record_remap(log, n, ids2, next2, 0, 2);
+    assert(sco_replay_start(log, n));
+    assert(strcmp(record_run(ids3), "CBACBA") == 0);
+    assert(sco_replay_stop() == n);
+
+    // A log that doesn't match the program is abandoned at the difference.
+    int64_t next3[3] = { ids3[2]+3, ids3[2]+4, ids3[2]+5 };
+    record_remap(log, n, ids3, next3, 0, 2);
+    assert(sco_replay_start(log, n));
+    assert(strcmp(record_run(ids1), "ABCABC") == 0);
+    assert(!sco_replaying());
+    assert(sco_replay_stop() < n);
+
+    // The runloop polling while everyone sleeps doesn't add events, and the
+    // timers that woke the sleepers are in the log.
+    assert(sco_record_start(64));
+    assert(strcmp(record_sleep_run(ids1), "ABC") == 0);
+    n = sco_record_get(log, 64);
+    sco_record_stop();
+    assert(n < 64);
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        counts[SCO_EVENT_TYPE(log[i])]++;
+        assert(i == 0 || log[i] != log[i-1]);
+    }
+    assert(counts[SCO_EVENT_WAKE] == 3 && counts[SCO_EVENT_RESUME] == 0);
+
+    // Replaying wakes the sleepers in the order of the log, not the order
+    // of their deadlines.
+    int64_t next4[3] = { ids1[2]+2, ids1[2]+3, ids1[2]+4 };
+    record_remap(log, n, ids1, next4, 0, 0);
+    assert(sco_replay_start(log, n));
+    assert(strcmp(record_sleep_run(ids2), "ABC") == 0);
+    assert(sco_replay_stop() == n);
+    int64_t next5[3] = { ids2[2]+2, ids2[2]+3, ids2[2]+4 };
+    record_remap(log, n, ids2, next5, 0, 2);
+    assert(sco_replay_start(log, n));
+    assert(strcmp(record_sleep_run(ids3), "CBA") == 0);
+    assert(sco_replay_stop() == n);
+}
+
+static int64_t sched_id;
+static int sched_runs;
+
+static void sched_entry(void *udata) {
+    (void)udata;
+    sched_id = sco_id();
+    assert(!sco_sched_set(NULL));
+    sco_pause();
+    sched_runs++;
+}
+
+void test_sco_sched(void) {
+    struct sco_sched *def = sco_sched_get();
+    struct sco_sched *sched = sco_sched_new();
+    assert(sched && sched != def);
+    quick_start(sched_entry, co_cleanup, 0);
+    int64_t id1 = sched_id;
+    assert(sco_info_paused() == 1);
+
+    // The other scheduler has its own coroutines.
+    assert(sco_sched_set(sched));
+    assert(sco_sched_get() == sched);
+    assert(!sco_active());
+    quick_start(sched_entry, co_cleanup, 0);
+    int64_t id2 = sched_id;
+    assert(sco_info_paused() == 1);
+    sco_resume(id1);
+    assert(sched_runs == 0);
+    assert(!sco_sched_free(sched));
+
+    assert(sco_sched_set(NULL));
+    assert(sco_sched_get() == def);
+    sco_resume(id2);
+    assert(sched_runs == 0);
+    sco_resume(id1);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sched_runs == 1);
+
+    assert(sco_sched_set(sched));
+    assert(sco_info_paused() == 1);
+    sco_resume(id2);
+    while (sco_active()) {
+        sco_resume(0);
+    }
+    assert(sched_runs == 2);
+    assert(sco_sched_set(def));
+    assert(sco_sched_get() == def);
+    assert(sco_sched_free(sched));
+    assert(!sco_sched_free(def));
+}
+
 int main(int argc, char **argv) {
     do_test(test_sco_start);
     do_test(test_sco_sleep);
+    do_test(test_sco_timer);
     do_test(test_sco_pause);
     do_test(test_sco_exit);
+    do_test(test_sco_handle);
+    do_test(test_sco_resume_many);
+    do_test(test_sco_yield_to);
+    do_test(test_sco_sync);
+    do_test(test_sco_group);
+    do_test(test_sco_spawn);
+    do_test(test_sco_priority);
+    do_test(test_sco_stats);
+    do_test(test_sco_slice);
+    do_test(test_sco_quantum);
+    do_test(test_sco_pooled);
+    do_test(test_sco_worker);
+    do_test(test_sco_node);
+    do_test(test_sco_stack_info);
+#ifndef __EMSCRIPTEN__
+    do_test(test_sco_poll);
+#endif
     do_test(test_sco_order);
 #ifndef __EMSCRIPTEN__
     do_test(test_sco_detach);
+    do_test(test_sco_detach_many);
+    do_test(test_sco_inbox);
+    do_test(test_sco_pool);
+    do_test(test_sco_pool_numa);
 #endif
     do_test(test_sco_unwind);
+    do_test(test_sco_unwind_ips);
+    do_test(test_sco_dump);
+    do_test(test_sco_dump_batches);
+    do_test(test_sco_record);
+    do_test(test_sco_sched);
     do_test(test_sco_various);
     return 0;
 }
@@ -98,7 +98,7 @@ static int64_t getnow(void) {
     return (now.tv_sec*INT64_C(1000000000) + now.tv_nsec);
 }
 
-static void sco_sleep(int64_t nanosecs) {
+static void cpu_sleep(int64_t nanosecs) {
     int64_t start = getnow();
     while (getnow()-start < nanosecs) {
         sco_yield();